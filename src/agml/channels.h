@@ -35,6 +35,7 @@ knowledge of the CeCILL license and that you accept its terms.
 #define CHANNELS_H_
 
 #include "com/message.h"
+#include "com/codec.h"
 
 #define AGML_CHANNEL_TRAINING_DATA 0
 #define AGML_CHANNEL_CODEBOOK 1
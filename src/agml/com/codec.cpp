@@ -0,0 +1,371 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#include "codec.h"
+#include "message.h"
+#include <agml/node.h>
+#include <util/utils.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <emmintrin.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define AGML_HAVE_F16C_DISPATCH
+#endif
+
+
+int codec_from_name(const std::string& s) {
+	if(s=="fp32" || s=="float" || s.empty()) return AGML_CODEC_FP32;
+	if(s=="fp16" || s=="half") return AGML_CODEC_FP16;
+	if(s=="bf16") return AGML_CODEC_BF16;
+	if(s=="int8") return AGML_CODEC_INT8;
+	throw std::runtime_error(TOSTRING("Unknown codec : " << s));
+}
+
+const char* codec_name(int codec) {
+	switch(codec) {
+	case AGML_CODEC_FP16: return "fp16";
+	case AGML_CODEC_BF16: return "bf16";
+	case AGML_CODEC_INT8: return "int8";
+	default: return "fp32";
+	}
+}
+
+size_t codec_encoded_size(int codec, size_t h, size_t w) {
+	switch(codec) {
+	case AGML_CODEC_FP16:
+	case AGML_CODEC_BF16: return h*w*sizeof(uint16_t);
+	case AGML_CODEC_INT8: return h*sizeof(float) + h*w;
+	default: return h*w*sizeof(float);
+	}
+}
+
+
+
+//////////
+// FP16 //
+//////////
+
+static inline uint16_t float_to_half(float f) {
+	uint32_t x; memcpy(&x, &f, 4);
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t mant = x & 0x7fffff;
+	int e = (int)((x >> 23) & 0xff);
+	if(e==0xff) return sign | 0x7c00 | (mant ? 0x200 : 0);
+	e += 15 - 127;
+	if(e >= 31) return sign | 0x7c00;
+	if(e <= 0) { // subnormal (or zero) half
+		if(e < -10) return sign;
+		mant |= 0x800000;
+		uint32_t shift = 14 - e;
+		uint32_t h = mant >> shift, rem = mant & ((1u << shift) - 1), half = 1u << (shift - 1);
+		if(rem > half || (rem==half && (h & 1))) h++;
+		return sign | h;
+	}
+	uint32_t h = ((uint32_t)e << 10) | (mant >> 13), rem = mant & 0x1fff;
+	if(rem > 0x1000 || (rem==0x1000 && (h & 1))) h++; // a carry correctly rounds up the exponent
+	return sign | h;
+}
+
+static inline float half_to_float(uint16_t h) {
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16, e = (h >> 10) & 0x1f, mant = h & 0x3ff, x;
+	if(e==0) {
+		if(!mant) x = sign;
+		else {
+			e = 127 - 15 + 1;
+			while(!(mant & 0x400)) { mant <<= 1; e--; }
+			x = sign | (e << 23) | ((mant & 0x3ff) << 13);
+		}
+	}
+	else if(e==31) x = sign | 0x7f800000 | (mant << 13);
+	else x = sign | ((e - 15 + 127) << 23) | (mant << 13);
+	float f; memcpy(&f, &x, 4);
+	return f;
+}
+
+#ifdef AGML_HAVE_F16C_DISPATCH
+__attribute__((target("avx,f16c"))) static size_t encode_fp16_f16c(const float* in, uint16_t* out, size_t n) {
+	size_t i = 0;
+	for(; i+8<=n; i+=8) _mm_storeu_si128((__m128i*)&out[i], _mm256_cvtps_ph(_mm256_loadu_ps(&in[i]), 0));
+	return i;
+}
+
+__attribute__((target("avx,f16c"))) static size_t decode_fp16_f16c(const uint16_t* in, float* out, size_t n) {
+	size_t i = 0;
+	for(; i+8<=n; i+=8) _mm256_storeu_ps(&out[i], _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)&in[i])));
+	return i;
+}
+
+static bool has_f16c() {
+	static int b = -1;
+	if(b<0) b = __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+	return b;
+}
+#endif
+
+static void encode_fp16(const float* in, uint16_t* out, size_t n) {
+	size_t i = 0;
+#ifdef AGML_HAVE_F16C_DISPATCH
+	if(has_f16c()) i = encode_fp16_f16c(in, out, n);
+#endif
+	for(; i<n; i++) out[i] = float_to_half(in[i]);
+}
+
+static void decode_fp16(const uint16_t* in, float* out, size_t n) {
+	size_t i = 0;
+#ifdef AGML_HAVE_F16C_DISPATCH
+	if(has_f16c()) i = decode_fp16_f16c(in, out, n);
+#endif
+	for(; i<n; i++) out[i] = half_to_float(in[i]);
+}
+
+
+
+//////////
+// BF16 //
+//////////
+
+static void encode_bf16(const float* in, uint16_t* out, size_t n) {
+	const __m128i one = _mm_set1_epi32(1), bias = _mm_set1_epi32(0x7fff);
+	size_t i = 0;
+	for(; i+8<=n; i+=8) {
+		__m128i a = _mm_castps_si128(_mm_loadu_ps(&in[i])), b = _mm_castps_si128(_mm_loadu_ps(&in[i+4]));
+		// Round to nearest even, then sign-extend the upper halves so that the signed pack keeps their bits
+		a = _mm_add_epi32(a, _mm_add_epi32(bias, _mm_and_si128(_mm_srli_epi32(a, 16), one)));
+		b = _mm_add_epi32(b, _mm_add_epi32(bias, _mm_and_si128(_mm_srli_epi32(b, 16), one)));
+		a = _mm_srai_epi32(a, 16); b = _mm_srai_epi32(b, 16);
+		_mm_storeu_si128((__m128i*)&out[i], _mm_packs_epi32(a, b));
+	}
+	for(; i<n; i++) {
+		uint32_t x; memcpy(&x, &in[i], 4);
+		out[i] = (uint16_t)((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+	}
+}
+
+static void decode_bf16(const uint16_t* in, float* out, size_t n) {
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for(; i+8<=n; i+=8) {
+		__m128i v = _mm_loadu_si128((const __m128i*)&in[i]);
+		_mm_storeu_ps(&out[i], _mm_castsi128_ps(_mm_unpacklo_epi16(zero, v)));
+		_mm_storeu_ps(&out[i+4], _mm_castsi128_ps(_mm_unpackhi_epi16(zero, v)));
+	}
+	for(; i<n; i++) {
+		uint32_t x = (uint32_t)in[i] << 16;
+		memcpy(&out[i], &x, 4);
+	}
+}
+
+
+
+//////////
+// INT8 //
+//////////
+
+static float absmax(const float* in, size_t n) {
+	const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 m = _mm_setzero_ps();
+	size_t i = 0;
+	for(; i+4<=n; i+=4) m = _mm_max_ps(m, _mm_and_ps(mask, _mm_loadu_ps(&in[i])));
+	float r[4]; _mm_storeu_ps(r, m);
+	float res = MAX(MAX(r[0], r[1]), MAX(r[2], r[3]));
+	for(; i<n; i++) res = MAX(res, fabsf(in[i]));
+	return res;
+}
+
+static void encode_int8_row(const float* in, int8_t* out, size_t n, float inv) {
+	const __m128 s = _mm_set1_ps(inv);
+	size_t i = 0;
+	for(; i+16<=n; i+=16) {
+		__m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&in[i]), s));
+		__m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&in[i+4]), s));
+		__m128i c = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&in[i+8]), s));
+		__m128i d = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&in[i+12]), s));
+		_mm_storeu_si128((__m128i*)&out[i], _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+	}
+	for(; i<n; i++) out[i] = (int8_t)lrintf(in[i]*inv);
+}
+
+static void decode_int8_row(const int8_t* in, float* out, size_t n, float scale) {
+	const __m128 s = _mm_set1_ps(scale);
+	size_t i = 0;
+	for(; i+16<=n; i+=16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)&in[i]);
+		__m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8), hi = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+		_mm_storeu_ps(&out[i], _mm_mul_ps(s, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16))));
+		_mm_storeu_ps(&out[i+4], _mm_mul_ps(s, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16))));
+		_mm_storeu_ps(&out[i+8], _mm_mul_ps(s, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16))));
+		_mm_storeu_ps(&out[i+12], _mm_mul_ps(s, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16))));
+	}
+	for(; i<n; i++) out[i] = scale*in[i];
+}
+
+/** Layout : h float scales, then the h*w quantized values */
+static void encode_int8(const float* in, size_t h, size_t w, unsigned char* out) {
+	float* scales = (float*)out;
+	int8_t* q = (int8_t*)(out + h*sizeof(float));
+	for(size_t i=0; i<h; i++) {
+		float m = absmax(&in[i*w], w);
+		scales[i] = m/127;
+		encode_int8_row(&in[i*w], &q[i*w], w, m>0 ? 127/m : 0);
+	}
+}
+
+static void decode_int8(const unsigned char* in, size_t h, size_t w, float* out) {
+	const float* scales = (const float*)in;
+	const int8_t* q = (const int8_t*)(in + h*sizeof(float));
+	for(size_t i=0; i<h; i++) decode_int8_row(&q[i*w], &out[i*w], w, scales[i]);
+}
+
+
+
+void codec_encode(int codec, const float* in, size_t h, size_t w, unsigned char* out) {
+	switch(codec) {
+	case AGML_CODEC_FP16: encode_fp16(in, (uint16_t*)out, h*w); break;
+	case AGML_CODEC_BF16: encode_bf16(in, (uint16_t*)out, h*w); break;
+	case AGML_CODEC_INT8: encode_int8(in, h, w, out); break;
+	default: memcpy(out, in, h*w*sizeof(float));
+	}
+}
+
+void codec_decode(int codec, const unsigned char* in, size_t h, size_t w, float* out) {
+	switch(codec) {
+	case AGML_CODEC_FP16: decode_fp16((const uint16_t*)in, out, h*w); break;
+	case AGML_CODEC_BF16: decode_bf16((const uint16_t*)in, out, h*w); break;
+	case AGML_CODEC_INT8: decode_int8(in, h, w, out); break;
+	default: memcpy(out, in, h*w*sizeof(float));
+	}
+}
+
+
+
+///////////////////
+// MATRIX STREAM //
+///////////////////
+
+void MatrixEncoder::configure(Node* node, const std::string& stream) {
+	std::string key = TOSTRING("codec." << stream);
+	codec = codec_from_name(node->has_property(key) ? node->get_property(key) : node->has_property("codec") ? node->get_property("codec") : "");
+	bErrorFeedback = node->get_property_int("error_feedback", 1)!=0;
+}
+
+void MatrixEncoder::add(Message& m, Matrix& mat, const std::vector<uint32_t>* rows) {
+	bool bSparse = rows && rows->size() < mat.height;
+	if(codec==AGML_CODEC_FP32 && !bSparse) { message_add_matrix(m, mat); return; }
+
+	size_t h = bSparse ? rows->size() : mat.height, w = mat.width;
+	bool bFeedback = bErrorFeedback && codec!=AGML_CODEC_FP32;
+	if(bFeedback) {
+		if(residual.height!=mat.height || residual.width!=w) {
+			residual.init(mat); residual = 0;
+			residual_old.init(mat);
+		}
+		residual_old = (const Matrix&) residual;
+	}
+
+	// Gather the rows to send, plus what previous sends failed to transmit
+	x.resize(h*w + 1);
+	for(size_t i=0; i<h; i++) {
+		size_t r = bSparse ? (*rows)[i] : i;
+		memcpy(&x[i*w], &mat.data[r*w], w*sizeof(float));
+		if(bFeedback) for(size_t j=0; j<w; j++) x[i*w+j] += residual.data[r*w+j];
+	}
+
+	buf.resize(codec_encoded_size(codec, h, w) + 1);
+	codec_encode(codec, &x[0], h, w, &buf[0]);
+
+	if(bFeedback) {
+		// Keep what we failed to send for next time : residual = x - decode(encode(x))
+		y.resize(h*w + 1);
+		codec_decode(codec, &buf[0], h, w, &y[0]);
+		for(size_t i=0; i<h; i++) {
+			size_t r = bSparse ? (*rows)[i] : i;
+			for(size_t j=0; j<w; j++) residual.data[r*w+j] = x[i*w+j] - y[i*w+j];
+		}
+	}
+
+	wire_width = w | ((size_t)codec << AGML_CODEC_SHIFT) | (bSparse ? AGML_MATRIX_SPARSE : 0);
+	m.add(mat.height);
+	m.add(wire_width);
+	if(bSparse) m.add((unsigned char*)(h ? &(*rows)[0] : NULL), h*sizeof(uint32_t));
+	m.add(&buf[0], codec_encoded_size(codec, h, w));
+}
+
+void MatrixEncoder::rollback() {
+	if(bErrorFeedback && residual) residual = (const Matrix&) residual_old;
+}
+
+
+
+void MatrixDelta::configure(Node* node, const std::string& stream) {
+	std::string key = TOSTRING("delta." << stream);
+	threshold = node->has_property(key) ? node->get_property_float(key, 0) : node->get_property_float("delta", 0);
+	resync_period = node->get_property_int("resync", 10);
+}
+
+const std::vector<uint32_t>* MatrixDelta::select(const Matrix& ref) {
+	if(threshold<=0) return NULL;
+	bool bFull = last.height!=ref.height || last.width!=ref.width || resync_period<=1 || nb_sends % resync_period == 0;
+	if(last.height!=ref.height || last.width!=ref.width) { last.init(ref); last_old.init(ref); }
+	last_old = (const Matrix&) last;
+	nb_sends++;
+
+	rows.clear();
+	float t2 = threshold*threshold;
+	for(size_t i=0; i<ref.height; i++) {
+		Matrix r = ref.row(i), l = last.row(i);
+		if(bFull || r.l2p2(l) > t2 * MAX(l.n2p2(), FLT_MIN)) {
+			rows.push_back(i);
+			memcpy(l.data, r.data, ref.width*sizeof(float));
+		}
+	}
+	return bFull ? NULL : &rows;
+}
+
+void MatrixDelta::rollback() {
+	if(threshold<=0 || !last) return;
+	last = (const Matrix&) last_old;
+	nb_sends--;
+}
+
+
+
+void message_add_matrix(Message& m, Matrix& mat, MatrixEncoder& enc) {
+	enc.add(m, mat);
+}
+
+void message_add_matrix(Message& m, Matrix& mat, const std::vector<uint32_t>* rows, MatrixEncoder& enc) {
+	enc.add(m, mat, rows);
+}
@@ -0,0 +1,137 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#ifndef LIBAGML_COM_CODEC_H_
+#define LIBAGML_COM_CODEC_H_
+
+#include "../math/Matrix.h"
+#include <common/Message.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class Node;
+
+
+/////////////////
+// WIRE CODECS //
+/////////////////
+
+/** Encodings of a h*w float Matrix payload on the wire. Lossy codecs trade precision for bandwidth */
+#define AGML_CODEC_FP32 0	// raw floats
+#define AGML_CODEC_FP16 1	// IEEE half floats (2 bytes/value)
+#define AGML_CODEC_BF16 2	// bfloat16 (2 bytes/value, full fp32 range)
+#define AGML_CODEC_INT8 3	// 1 byte/value, linear with one float scale per row
+
+/** The codec of an encoded payload is tagged in the top byte of its width element */
+#define AGML_CODEC_SHIFT 56
+/** Sparse payloads only carry some rows, listed in an extra element of uint32 row indices */
+#define AGML_MATRIX_SPARSE (((size_t)1)<<55)
+#define AGML_CODEC_WIDTH_MASK (AGML_MATRIX_SPARSE-1)
+
+/** @return the codec named s ("fp32", "fp16", "bf16" or "int8") */
+int codec_from_name(const std::string& s);
+const char* codec_name(int codec);
+
+size_t codec_encoded_size(int codec, size_t h, size_t w);
+void codec_encode(int codec, const float* in, size_t h, size_t w, unsigned char* out);
+void codec_decode(int codec, const unsigned char* in, size_t h, size_t w, float* out);
+
+
+/**
+ * Encodes the successive values of one Matrix stream (e.g. the S of a push-sum Node).
+ * With error feedback, the quantization error of each send is kept and added to the next one,
+ * so that no mass is lost over time and push-sum still converges to the exact average.
+ */
+class MatrixEncoder {
+public:
+	int codec;
+	bool bErrorFeedback;
+
+protected:
+	Matrix residual, residual_old;
+	std::vector<float> x, y;
+	std::vector<unsigned char> buf;
+	size_t wire_width;
+
+public:
+	MatrixEncoder() : codec(AGML_CODEC_FP32), bErrorFeedback(true), wire_width(0) {}
+
+	/** Reads the codec from the "codec.<stream>" (or else "codec") and "error_feedback" properties of node's group */
+	void configure(Node* node, const std::string& stream);
+
+	/**
+	 * Appends mat to m, or only the given rows of it (see MatrixDelta).
+	 * m refers to the encoder's buffer (and to rows) until it is sent
+	 */
+	void add(Message& m, Matrix& mat, const std::vector<uint32_t>* rows = NULL);
+
+	/** Undoes the last add() when its message couldn't be sent */
+	void rollback();
+};
+
+
+/**
+ * Picks the rows of a Matrix stream worth sending : those whose reference value (e.g. a centroid)
+ * moved by more than a relative threshold since they were last sent. All rows are sent every
+ * resync_period sends. A null threshold disables delta sending.
+ */
+class MatrixDelta {
+public:
+	float threshold;
+	int resync_period;
+
+protected:
+	Matrix last, last_old;
+	std::vector<uint32_t> rows;
+	int nb_sends;
+
+public:
+	MatrixDelta() : threshold(0), resync_period(10), nb_sends(0) {}
+
+	/** Reads the "delta.<stream>" (or else "delta") and "resync" properties of node's group */
+	void configure(Node* node, const std::string& stream);
+
+	/** @return the rows to send next, NULL meaning all of them */
+	const std::vector<uint32_t>* select(const Matrix& ref);
+
+	/** Undoes the last select() when its message couldn't be sent */
+	void rollback();
+};
+
+
+void message_add_matrix(Message& m, Matrix& mat, MatrixEncoder& enc);
+void message_add_matrix(Message& m, Matrix& mat, const std::vector<uint32_t>* rows, MatrixEncoder& enc);
+
+
+#endif /* LIBAGML_COM_CODEC_H_ */
@@ -33,7 +33,9 @@ knowledge of the CeCILL license and that you accept its terms.
 
 
 #include "message.h"
+#include "codec.h"
 #include <util/utils.h>
+#include <string.h>
 
 
 
@@ -55,8 +57,63 @@ void message_add_matrix(Message& m, Matrix& mat) {
 
 void message_get_matrix(Message* m, Matrix& mat) {
 	mat.height = m->get<size_t>();
-	mat.width = m->get<size_t>();
+	size_t w = m->get<size_t>();
+	int codec = (int)(w >> AGML_CODEC_SHIFT);
+	mat.width = w & AGML_CODEC_WIDTH_MASK;
 	mat.n = mat.height * mat.width;
-	mat.data = (float*)m->get_next(true).data;
-	mat.bDeleteData = m->bDataAllocated;
+	if(codec > AGML_CODEC_INT8) throw std::runtime_error(TOSTRING("Unknown matrix codec " << codec));
+	if(mat.width && mat.n/mat.width != mat.height) throw std::runtime_error(TOSTRING("Matrix of " << mat.height << "x" << mat.width << " is too large"));
+	if(w & AGML_MATRIX_SPARSE) {
+		// Missing rows are null contributions
+		MessageElt& rows = m->get_next();
+		size_t nb = rows.size/sizeof(uint32_t);
+		const uint32_t* r = (const uint32_t*)rows.data;
+		if(nb > mat.height) throw std::runtime_error(TOSTRING("Sparse matrix lists " << nb << " rows out of " << mat.height));
+		for(size_t i=0; i<nb; i++) {
+			if(r[i] >= mat.height) throw std::runtime_error(TOSTRING("Sparse matrix row " << r[i] << " out of " << mat.height));
+		}
+		MessageElt& payload = m->get_next();
+		if(payload.size != codec_encoded_size(codec, nb, mat.width))
+			throw std::runtime_error(TOSTRING("Sparse matrix payload of " << payload.size << " bytes for " << nb << "x" << mat.width << " " << codec_name(codec)));
+		mat.data = new float[mat.n];
+		mat.bDeleteData = true;
+		memset(mat.data, 0, mat.n*sizeof(float));
+		if(nb) {
+			Matrix packed(nb, mat.width);
+			codec_decode(codec, payload.data, nb, mat.width, packed.data);
+			for(size_t i=0; i<nb; i++) memcpy(&mat.data[r[i]*mat.width], &packed.data[i*mat.width], mat.width*sizeof(float));
+		}
+	} else {
+		MessageElt& payload = m->get_next();
+		if(payload.size != codec_encoded_size(codec, mat.height, mat.width))
+			throw std::runtime_error(TOSTRING("Matrix payload of " << payload.size << " bytes for " << mat.height << "x" << mat.width << " " << codec_name(codec)));
+		if(codec==AGML_CODEC_FP32) {
+			payload.bOwn = false; // the matrix takes the buffer over
+			mat.data = (float*)payload.data;
+			mat.bDeleteData = m->bDataAllocated;
+		} else {
+			mat.data = new float[mat.n];
+			mat.bDeleteData = true;
+			codec_decode(codec, payload.data, mat.height, mat.width, mat.data);
+		}
+	}
+}
+
+bool message_combine_matrix(Message* into, Message* m) {
+	size_t h = into->get<size_t>(), w = into->get<size_t>();
+	if(m->get<size_t>()!=h || m->get<size_t>()!=w) return false;
+	if(w & AGML_MATRIX_SPARSE) return false; // row sets may differ
+	// Re-quantizing a sum of lossy payloads would lose mass : only fp32 ones are merged
+	if((int)(w >> AGML_CODEC_SHIFT)!=AGML_CODEC_FP32) return false;
+	w &= AGML_CODEC_WIDTH_MASK;
+	// Headers may come from a remote host : both payloads must hold the h*w floats they announce
+	size_t n = h*w;
+	if(w && n/w!=h) return false;
+	MessageElt& ea = into->get_next();
+	MessageElt& eb = m->get_next();
+	if(ea.size!=n*sizeof(float) || eb.size!=n*sizeof(float)) return false;
+	float* a = (float*)ea.data;
+	const float* b = (const float*)eb.data;
+	for(size_t i=0; i<n; i++) a[i] += b[i];
+	return true;
 }
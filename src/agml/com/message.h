@@ -41,7 +41,13 @@ knowledge of the CeCILL license and that you accept its terms.
 
 void message_add_matrix(Message& m, Matrix& mat);
 //Matrix message_get_matrix(Message* m);
+/** Decodes lossy (see codec.h) and sparse payloads into a dense float Matrix */
 void message_get_matrix(Message* m, Matrix& mat);
 
 
+/** Combiner helpers : add the next matrix (resp. value) of m to the one of into, in place. Sparse and lossy matrices don't combine */
+bool message_combine_matrix(Message* into, Message* m);
+template <typename T> void message_combine(Message* into, Message* m) { *((T*)into->get_next().data) += m->get<T>(); }
+
+
 #endif /* AGML_COM_MESSAGE_H_ */
@@ -0,0 +1,364 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#include "FileLoader.h"
+#include <veccodec.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdexcept>
+
+#define FILELOADER_CHUNK_SIZE (4*1024*1024)
+
+#define PHASE_COUNT 0
+#define PHASE_DECODE 1
+
+#define FILELOADER_CACHE_MAGIC "AGMLFC01"
+#define FILELOADER_CACHE_HEADER_SIZE 4096
+
+/** Header of a cache file, followed by height*width floats */
+struct FileCacheHeader {
+	char magic[8];
+	size_t height, width;
+	long mtime, size;
+	char path[FILELOADER_CACHE_HEADER_SIZE - 8 - 2*sizeof(size_t) - 2*sizeof(long)];
+};
+
+
+FileLoader::FileLoader(const std::string& file, int nb_threads, int cache) : file(file) {
+	this->nb_threads = MAX(1, nb_threads);
+	this->cache = cache;
+	cache_dir = TOSTRING(home() << "/.agml/cache");
+	data = 0;
+	height = width = 0;
+	load_time_ms = -1;
+	bError = false;
+	format = -1;
+	fd = -1;
+	file_size = 0;
+	map = 0;
+	bMalloc = false;
+	cache_map = 0;
+	cache_map_size = 0;
+	bWriteCache = false;
+	source_mtime = source_size = -1;
+	chunk_done = 0;
+	phase = PHASE_DECODE;
+	next_chunk = 0;
+	nb_finished = 0;
+	start_time = 0;
+}
+
+FileLoader::~FileLoader() {
+	join();
+	close_file();
+	delete[] chunk_done;
+	if(cache_map) munmap(cache_map, cache_map_size);
+	else if(bMalloc) free(data);
+	else delete[] data;
+}
+
+
+///////////////
+// LIFECYCLE //
+///////////////
+
+void FileLoader::start() {
+	start_time = get_time_ms();
+	format = veccodec_detect_format(file.c_str());
+	source_mtime = file_get_modification_time(file);
+	source_size = file_get_size(file);
+
+	// fvecs files are already binary, only text formats are worth caching
+	if(format!=VECCODEC_FORMAT_FVECS && cache!=FILELOADER_CACHE_OFF) {
+		cache_file = get_cache_file();
+		if(cache==FILELOADER_CACHE_ON && read_cache()) return;
+		bWriteCache = !cache_file.empty();
+	}
+
+	if(format==VECCODEC_FORMAT_FVECS) start_fvecs();
+	else if(format==VECCODEC_FORMAT_CSV) start_csv();
+	else {
+		veccodec_load_float(data, width, height, file.c_str());
+		bMalloc = true;
+		file_size = source_size;
+		set_single_chunk();
+		on_loaded();
+	}
+}
+
+void FileLoader::start_fvecs() {
+	if((fd = open(file.c_str(), O_RDONLY)) < 0) throw std::runtime_error(TOSTRING("Couldn't open " << file));
+	struct stat st;
+	fstat(fd, &st);
+	file_size = st.st_size;
+
+	int d = 0;
+	if(pread(fd, &d, sizeof(int), 0)!=sizeof(int) || d<=0) throw std::runtime_error(TOSTRING("Bad fvecs header in " << file));
+	width = d;
+	size_t row_size = sizeof(int) + width*sizeof(float);
+	if(file_size % row_size) throw std::runtime_error(TOSTRING("Truncated fvecs file " << file));
+	height = file_size / row_size;
+
+	size_t rows_per_chunk = MAX((size_t)1, FILELOADER_CHUNK_SIZE / row_size);
+	for(size_t r = 0; r<height; r+=rows_per_chunk) {
+		chunk_row.push_back(r);
+		chunk_offset.push_back(r*row_size);
+	}
+	chunk_row.push_back(height);
+	chunk_offset.push_back(file_size);
+
+	data = new float[height*width];
+	start_threads(PHASE_DECODE);
+}
+
+void FileLoader::start_csv() {
+	if((fd = open(file.c_str(), O_RDONLY)) < 0) throw std::runtime_error(TOSTRING("Couldn't open " << file));
+	struct stat st;
+	fstat(fd, &st);
+	file_size = st.st_size;
+	if(file_size==0) throw std::runtime_error(TOSTRING("Empty file " << file));
+
+	void* p = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(p==MAP_FAILED) throw std::runtime_error(TOSTRING("Couldn't map " << file));
+	map = (const unsigned char*)p;
+	madvise(p, file_size, MADV_WILLNEED);
+
+	// Split on line boundaries
+	for(size_t o = 0; o<file_size; ) {
+		chunk_offset.push_back(o);
+		size_t e = MIN(o + FILELOADER_CHUNK_SIZE, file_size);
+		const unsigned char* nl = e<file_size ? (const unsigned char*)memchr(map+e, '\n', file_size-e) : NULL;
+		o = nl ? (size_t)(nl-map)+1 : file_size;
+	}
+	chunk_offset.push_back(file_size);
+
+	// Count rows of each chunk, then decode them at their final place
+	chunk_count.resize(chunk_offset.size()-1);
+	start_threads(PHASE_COUNT);
+	join();
+	if(bError) throw std::runtime_error(error);
+
+	chunk_row.push_back(0);
+	for(size_t k=0; k<chunk_count.size(); k++) chunk_row.push_back(chunk_row.back() + chunk_count[k]);
+	height = chunk_row.back();
+
+	data = new float[height*width];
+	start_threads(PHASE_DECODE);
+}
+
+static void* _run_loader(void* p) { ((FileLoader*)p)->run(); return 0; }
+
+void FileLoader::start_threads(int phase) {
+	this->phase = phase;
+	next_chunk = 0;
+	nb_finished = 0;
+	if(phase==PHASE_DECODE && !chunk_done) {
+		chunk_done = new char[chunk_offset.size()-1];
+		memset((void*)chunk_done, 0, chunk_offset.size()-1);
+	}
+	threads.resize(nb_threads);
+	for(int i=0; i<nb_threads; i++) pthread_create(&threads[i], NULL, _run_loader, this);
+}
+
+void FileLoader::join() {
+	for(uint i=0; i<threads.size(); i++) pthread_join(threads[i], NULL);
+	threads.clear();
+}
+
+void FileLoader::set_single_chunk() {
+	chunk_row.clear(); chunk_offset.clear();
+	chunk_row.push_back(0); chunk_row.push_back(height);
+	chunk_offset.push_back(0); chunk_offset.push_back(file_size);
+	chunk_done = new char[1]; chunk_done[0] = 1;
+	nb_finished = nb_threads;
+}
+
+void FileLoader::on_loaded() {
+	load_time_ms = get_time_ms() - start_time;
+	close_file();
+	DBG("Loaded " << file << " (" << height << "x" << width << ") in " << load_time_ms << "ms with " << nb_threads << " I/O threads"
+			<< " (" << (load_time_ms>0 ? file_size/1000/load_time_ms : 0) << " MB/s)");
+	if(bWriteCache) write_cache();
+}
+
+void FileLoader::close_file() {
+	if(map) munmap((void*)map, file_size);
+	map = 0;
+	if(fd>=0) close(fd);
+	fd = -1;
+}
+
+
+/////////////////
+// I/O THREADS //
+/////////////////
+
+void FileLoader::run() {
+	std::vector<unsigned char> buf;
+	size_t nb_chunks = chunk_offset.size()-1;
+	try {
+		for(;;) {
+			size_t k = __sync_fetch_and_add(&next_chunk, 1);
+			if(k>=nb_chunks) break;
+			process_chunk(k, buf);
+		}
+	}
+	catch(std::exception& e) { error = e.what(); bError = true; }
+	catch(...) { error = TOSTRING("Couldn't decode " << file); bError = true; }
+
+	if(__sync_add_and_fetch(&nb_finished, 1)==nb_threads && phase==PHASE_DECODE && !bError) on_loaded();
+}
+
+void FileLoader::process_chunk(size_t k, std::vector<unsigned char>& buf) {
+	size_t offset = chunk_offset[k];
+	size_t size = chunk_offset[k+1] - offset;
+
+	if(phase==PHASE_COUNT) {
+		size_t d = 0, c = 0;
+		veccodec_decode_csv_float(NULL, d, c, map+offset, size);
+		chunk_count[k] = c;
+		if(c>0) {
+			size_t w = __sync_val_compare_and_swap(&width, 0, d);
+			if(w!=0 && w!=d) throw std::runtime_error(TOSTRING("Inconsistent vectors dimension in " << file << " (" << w << "!=" << d << ")"));
+		}
+		return;
+	}
+
+	size_t row = chunk_row[k];
+	size_t nb_rows = chunk_row[k+1] - row;
+	if(format==VECCODEC_FORMAT_CSV) {
+		size_t d = width;
+		if(nb_rows>0) veccodec_decode_csv_float(&data[row*width], d, nb_rows, map+offset, size);
+	} else {
+		buf.resize(size);
+		for(size_t n = 0; n<size; ) {
+			ssize_t r = pread(fd, &buf[n], size-n, offset+n);
+			if(r<=0) throw std::runtime_error(TOSTRING("Couldn't read " << file << " at offset " << offset+n));
+			n += r;
+		}
+		veccodec_decode_fvecs(&data[row*width], width, nb_rows, &buf[0], size);
+	}
+
+	__sync_synchronize();
+	chunk_done[k] = 1;
+}
+
+bool FileLoader::is_ready(size_t from, size_t to) {
+	if(from>=to || chunk_row.empty() || !chunk_done) return from>=to;
+	size_t k = std::upper_bound(chunk_row.begin(), chunk_row.end(), from) - chunk_row.begin() - 1;
+	for(; k+1<chunk_row.size() && chunk_row[k]<to; k++) {
+		if(!chunk_done[k]) return false;
+	}
+	return true;
+}
+
+
+
+///////////
+// CACHE //
+///////////
+
+std::string FileLoader::get_cache_file() {
+	std::string path = file_absolute_path(file);
+	if(path.length() >= sizeof(((FileCacheHeader*)0)->path)) return "";
+	unsigned long h = 14695981039346656037UL; // FNV-1a
+	for(size_t i=0; i<path.length(); i++) { h ^= (unsigned char)path[i]; h *= 1099511628211UL; }
+	return TOSTRING(cache_dir << "/" << file_basename(path) << "." << std::hex << h << ".fcache");
+}
+
+bool FileLoader::read_cache() {
+	int f = open(cache_file.c_str(), O_RDONLY);
+	if(f<0) return false;
+	struct stat st;
+	fstat(f, &st);
+	if((size_t)st.st_size < sizeof(FileCacheHeader)) { close(f); return false; }
+	void* p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, f, 0);
+	close(f);
+	if(p==MAP_FAILED) return false;
+
+	FileCacheHeader* h = (FileCacheHeader*)p;
+	if(memcmp(h->magic, FILELOADER_CACHE_MAGIC, 8) || h->mtime!=source_mtime || h->size!=source_size
+			|| file_absolute_path(file)!=h->path
+			|| (size_t)st.st_size != sizeof(FileCacheHeader) + h->height*h->width*sizeof(float)) {
+		munmap(p, st.st_size);
+		return false;
+	}
+
+	cache_map = p;
+	cache_map_size = st.st_size;
+	madvise(p, cache_map_size, MADV_WILLNEED);
+	height = h->height;
+	width = h->width;
+	data = (float*)((unsigned char*)p + sizeof(FileCacheHeader));
+	file_size = cache_map_size;
+	set_single_chunk();
+	load_time_ms = get_time_ms() - start_time;
+	DBG("Loaded " << file << " (" << height << "x" << width << ") from cache " << cache_file << " in " << load_time_ms << "ms");
+	return true;
+}
+
+void FileLoader::write_cache() {
+	create_dir_for(cache_file);
+	// A unique temporary per writer : nodes loading the same file may cache it concurrently, the last rename wins
+	std::string tmp = cache_file + ".XXXXXX";
+	int fd = mkstemp(&tmp[0]);
+	FILE* f = fd<0 ? NULL : fdopen(fd, "wb");
+	if(!f) {
+		ERROR("Couldn't write cache file " << tmp);
+		if(fd>=0) { close(fd); unlink(tmp.c_str()); }
+		return;
+	}
+	fchmod(fd, 0644);
+
+	FileCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, FILELOADER_CACHE_MAGIC, 8);
+	h.height = height;
+	h.width = width;
+	h.mtime = source_mtime;
+	h.size = source_size;
+	strcpy(h.path, file_absolute_path(file).c_str());
+
+	bool ok = fwrite(&h, sizeof(h), 1, f)==1 && fwrite(data, sizeof(float), height*width, f)==height*width;
+	ok = fclose(f)==0 && ok;
+	if(!ok || rename(tmp.c_str(), cache_file.c_str())!=0) {
+		ERROR("Couldn't write cache file " << cache_file);
+		unlink(tmp.c_str());
+		return;
+	}
+	DBG("Cached " << file << " to " << cache_file);
+}
@@ -0,0 +1,125 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#ifndef AGML_IO_FILELOADER_H_
+#define AGML_IO_FILELOADER_H_
+
+#include <util/utils.h>
+#include <pthread.h>
+#include <vector>
+#include <string>
+
+#define FILELOADER_CACHE_OFF 0
+#define FILELOADER_CACHE_ON 1
+#define FILELOADER_CACHE_REFRESH 2
+
+/**
+ * Parallel vector file loader.
+ * The file is split into row chunks that a pool of I/O threads decodes in file order,
+ * so the first rows become available while the rest of the file is still being read.
+ * fvecs files are read with pread() on byte ranges, CSV files are mapped and split on line boundaries.
+ * Other formats fall back to a synchronous veccodec_load_float().
+ *
+ * Text files can be cached as raw floats in cache_dir, keyed by path, modification time and size.
+ * The cache file is a page-sized header followed by the row-major floats, so that it is simply mmapped on later runs.
+ */
+class FileLoader {
+public:
+	std::string file;
+	int nb_threads;
+
+	int cache;
+	std::string cache_dir;
+	std::string cache_file;
+
+	float* data;
+	size_t height, width;
+
+	long load_time_ms;
+	bool bError;
+	std::string error;
+
+private:
+	int format;
+	int fd;
+	size_t file_size;
+	const unsigned char* map;
+	bool bMalloc;
+	void* cache_map;
+	size_t cache_map_size;
+	bool bWriteCache;
+	long source_mtime, source_size;
+
+	std::vector<size_t> chunk_row;		// First row of each chunk (chunk_row.back() == height)
+	std::vector<size_t> chunk_offset;	// First byte of each chunk (chunk_offset.back() == file_size)
+	std::vector<size_t> chunk_count;
+	volatile char* chunk_done;
+
+	int phase;
+	volatile size_t next_chunk;
+	volatile int nb_finished;
+	long start_time;
+
+	std::vector<pthread_t> threads;
+
+public:
+	FileLoader(const std::string& file, int nb_threads = 4, int cache = FILELOADER_CACHE_OFF);
+	~FileLoader();
+
+	/** Open the file and start the I/O threads. Returns as soon as the data dimensions are known */
+	void start();
+
+	/** @return true if rows [from,to[ have been decoded */
+	bool is_ready(size_t from, size_t to);
+	inline bool is_done() { return nb_finished==nb_threads; }
+
+	void join();
+
+	INTERNAL void run();
+
+private:
+	void start_fvecs();
+	void start_csv();
+	void start_threads(int phase);
+	void process_chunk(size_t k, std::vector<unsigned char>& buf);
+	void close_file();
+	void set_single_chunk();
+	void on_loaded();
+
+	std::string get_cache_file();
+	bool read_cache();
+	void write_cache();
+};
+
+
+#endif /* AGML_IO_FILELOADER_H_ */
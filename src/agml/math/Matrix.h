@@ -173,8 +173,8 @@ public:
 
 	inline Matrix& operator+=(float f) {for(size_t i = 0; i<n; i++) data[i] += f; return *this;}
 
-	inline Matrix& randf() { for(size_t i=0; i<n; i++) data[i] = ::randf(); return *this;}
-	inline Matrix& randf(float min, float max) { for(size_t i=0; i<n; i++) data[i] = ::randf(min,max); return *this;}
+	inline Matrix& randf() { rng_thread_local().fill(data, n); return *this;}
+	inline Matrix& randf(float min, float max) { rng_thread_local().fill(data, n, min, max); return *this;}
 
 
 	float l2p2(const Matrix& m) const;
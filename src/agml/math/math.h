@@ -36,9 +36,10 @@ knowledge of the CeCILL license and that you accept its terms.
 
 #include <stdlib.h>
 #include <limits.h>
+#include <util/rng.h>
 
-inline float randf() {return (float)rand()/INT_MAX;}
-inline float randf(float min, float max) { return randf()*(max-min) + min; }
+inline float randf() {return rng_thread_local().randf();}
+inline float randf(float min, float max) { return rng_thread_local().randf(min, max); }
 
 
 
@@ -0,0 +1,162 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#include "random.h"
+#include <util/utils.h>
+#include <math.h>
+#include <pthread.h>
+#include <vector>
+
+#define RANDOM_BLOCK_SIZE (1024*1024)
+
+
+static inline uint64_t random_block_seed(uint64_t seed, size_t block) {
+	return seed + block*0xd1b54a32d192ed03ULL;	// Rng::seed() mixes it
+}
+
+static inline void random_gaussian_pair(Rng& rg, float& a, float& b) {
+	float u = 1.0f - rg.randf();
+	float v = rg.randf();
+	float r = sqrtf(-2.0f*logf(u));
+	a = r*cosf(2.0f*(float)M_PI*v);
+	b = r*sinf(2.0f*(float)M_PI*v);
+}
+
+
+
+//////////////////
+// FILL WORKERS //
+//////////////////
+
+/** A fill split into nb_blocks independent blocks, drawn by a pool of threads */
+class RandomFill {
+public:
+	uint64_t seed;
+	size_t nb_blocks;
+	volatile size_t next_block;
+
+	RandomFill(uint64_t seed, size_t nb_blocks) : seed(seed), nb_blocks(nb_blocks) { next_block = 0; }
+	virtual ~RandomFill() {}
+
+	virtual void fill_block(size_t b, Rng& rg) = 0;
+
+	void run() {
+		for(;;) {
+			size_t b = __sync_fetch_and_add(&next_block, 1);
+			if(b>=nb_blocks) break;
+			Rng rg(random_block_seed(seed, b));
+			fill_block(b, rg);
+		}
+	}
+
+	void execute(int nb_threads) {
+		nb_threads = (int)MIN((size_t)MAX(1, nb_threads), nb_blocks);
+		std::vector<pthread_t> threads(nb_threads > 1 ? nb_threads-1 : 0);
+		for(uint i=0; i<threads.size(); i++) pthread_create(&threads[i], NULL, _run, this);
+		run();
+		for(uint i=0; i<threads.size(); i++) pthread_join(threads[i], NULL);
+	}
+
+private:
+	static void* _run(void* p) { ((RandomFill*)p)->run(); return 0; }
+};
+
+class RandomFillUniform : public RandomFill {
+public:
+	float* data; size_t n; float min, max;
+	RandomFillUniform(float* data, size_t n, float min, float max, uint64_t seed) :
+		RandomFill(seed, (n+RANDOM_BLOCK_SIZE-1)/RANDOM_BLOCK_SIZE), data(data), n(n), min(min), max(max) {}
+
+	virtual void fill_block(size_t b, Rng& rg) {
+		size_t end = MIN(n, (b+1)*RANDOM_BLOCK_SIZE);
+		rg.fill(&data[b*RANDOM_BLOCK_SIZE], end - b*RANDOM_BLOCK_SIZE, min, max);
+	}
+};
+
+class RandomFillGaussian : public RandomFill {
+public:
+	float* data; size_t n; float mean, stddev;
+	RandomFillGaussian(float* data, size_t n, float mean, float stddev, uint64_t seed) :
+		RandomFill(seed, (n+RANDOM_BLOCK_SIZE-1)/RANDOM_BLOCK_SIZE), data(data), n(n), mean(mean), stddev(stddev) {}
+
+	virtual void fill_block(size_t b, Rng& rg) {
+		size_t end = MIN(n, (b+1)*RANDOM_BLOCK_SIZE);
+		float g1, g2;
+		for(size_t i=b*RANDOM_BLOCK_SIZE; i<end; i+=2) {
+			random_gaussian_pair(rg, g1, g2);
+			data[i] = mean + stddev*g1;
+			if(i+1<end) data[i+1] = mean + stddev*g2;
+		}
+	}
+};
+
+class RandomFillBlobs : public RandomFill {
+public:
+	float* X; size_t n, D; const float* centers; size_t K; float spread;
+	size_t rows_per_block;
+	RandomFillBlobs(float* X, size_t n, size_t D, const float* centers, size_t K, float spread, uint64_t seed, size_t rows_per_block) :
+		RandomFill(seed, (n+rows_per_block-1)/rows_per_block), X(X), n(n), D(D), centers(centers), K(K), spread(spread), rows_per_block(rows_per_block) {}
+
+	virtual void fill_block(size_t b, Rng& rg) {
+		size_t end = MIN(n, (b+1)*rows_per_block);
+		float g1, g2;
+		for(size_t i=b*rows_per_block; i<end; i++) {
+			const float* c = &centers[rg.uniform(K)*D];
+			float* x = &X[i*D];
+			for(size_t j=0; j<D; j+=2) {
+				random_gaussian_pair(rg, g1, g2);
+				x[j] = c[j] + spread*g1;
+				if(j+1<D) x[j+1] = c[j+1] + spread*g2;
+			}
+		}
+	}
+};
+
+
+
+//////////////
+// FRONTEND //
+//////////////
+
+void random_fill_uniform(float* data, size_t n, float min, float max, uint64_t seed, int nb_threads) {
+	RandomFillUniform(data, n, min, max, seed).execute(nb_threads);
+}
+
+void random_fill_gaussian(float* data, size_t n, float mean, float stddev, uint64_t seed, int nb_threads) {
+	RandomFillGaussian(data, n, mean, stddev, seed).execute(nb_threads);
+}
+
+void random_fill_blobs(float* X, size_t n, size_t D, const float* centers, size_t K, float spread, uint64_t seed, int nb_threads) {
+	if(K==0 || D==0) return;
+	RandomFillBlobs(X, n, D, centers, K, spread, seed, MAX((size_t)1, RANDOM_BLOCK_SIZE/D)).execute(nb_threads);
+}
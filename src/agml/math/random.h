@@ -0,0 +1,61 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#ifndef AGML_RANDOM_H_
+#define AGML_RANDOM_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <util/rng.h>
+
+/**
+ * Reproducible parallel random fills.
+ * Buffers are split into fixed-size blocks, each one drawn by its own Rng seeded from (seed, block index),
+ * so the output only depends on the seed, whatever the number of threads.
+ * Nodes should draw their seed from their own generator (Node::rng()), seeded by the model's seed and their description.
+ */
+
+/** Fill data with n floats uniformly drawn in [min,max[ */
+void random_fill_uniform(float* data, size_t n, float min, float max, uint64_t seed, int nb_threads = 1);
+
+/** Fill data with n floats drawn from N(mean, stddev^2) */
+void random_fill_gaussian(float* data, size_t n, float mean, float stddev, uint64_t seed, int nb_threads = 1);
+
+/**
+ * Fill the n x D matrix X with samples of a gaussian mixture :
+ * each row is a uniformly chosen row of the K x D centers matrix plus isotropic noise of standard deviation spread
+ */
+void random_fill_blobs(float* X, size_t n, size_t D, const float* centers, size_t K, float spread, uint64_t seed, int nb_threads = 1);
+
+
+#endif /* AGML_RANDOM_H_ */
@@ -45,7 +45,7 @@ public:
 
 	virtual void process() {
 		if(get_nb_outs()>0){
-			int i = rand()%get_nb_outs();
+			int i = rng().uniform(get_nb_outs());
 			send(i, 0, (const unsigned char*)s, 1000);
 		}
 		usleep(100);
@@ -43,8 +43,22 @@ public:
 
 	Matrix S;
 	float w;
+
+	MatrixEncoder S_enc;
 public:
 
+	NodeAvg() {
+		set_combiner(AGML_CHANNEL_GRADIENT, combine_gradients);
+		set_loss_tolerant(AGML_CHANNEL_GRADIENT);
+	}
+
+	/** Pending (S,w) contributions simply add up */
+	static bool combine_gradients(Message* into, Message* m) {
+		if(!message_combine_matrix(into, m)) return false;
+		message_combine<float>(into, m);
+		return true;
+	}
+
 	virtual void init_sum_weight(size_t n, size_t D) {
 		this->D = D;
 		this->n = n;
@@ -54,6 +68,7 @@ public:
 	}
 
 	virtual void init() {
+		S_enc.configure(this, "gradient");
 		if(X) {
 			if(!S) init_sum_weight(X.height, X.width);
 			S += X;
@@ -73,14 +88,15 @@ public:
 
 	virtual void process() {
 		if(get_nb_outs()>0){
-			int i = rand()%get_nb_outs();
+			int i = rng().uniform(get_nb_outs());
 
 			w/=2;S/=2;
 
 			Message m(AGML_CHANNEL_GRADIENT);
-			message_add_matrix(m, S);
+			message_add_matrix(m, S, S_enc);
 			m.add(w);
 			if(!send(i, m)) {
+				S_enc.rollback();
 				w*=2; S*=2;
 			}
 		}
@@ -104,6 +120,11 @@ public:
 			update();
 		}
 	}
+
+	/** The lost half of (S,w) comes back to us, as if we had never halved it */
+	virtual void on_dropped(Message* m) {
+		if(m->channel==AGML_CHANNEL_GRADIENT) on_receive(m);
+	}
 };
 
 AGML_NODE_CLASS(NodeAvg)
@@ -50,6 +50,9 @@ public:
 
 	virtual Matrix generate_data() = 0;
 
+	/** Asynchronous data providers return false while rows [from,to[ of the generated data are not available yet */
+	virtual bool is_ready(size_t from, size_t to) { return true; }
+
 	virtual void init() {
 		verbose = get_property_int("verbose", 0);
 		channel = get_property_int("channel", AGML_CHANNEL_TRAINING_DATA);
@@ -81,8 +84,12 @@ public:
 
 		for(int i=0; i<get_nb_outs(); i++) {
 			if(ack[i]) continue;
-			Message m(channel);
 			Matrix p = X.part(i, get_nb_outs());
+			if(p) {
+				size_t from = (p.data - X.data)/D;
+				if(!is_ready(from, from+p.height)) continue;
+			}
+			Message m(channel);
 			if(p) message_add_matrix(m, p);
 			if(!p || send(i, m)) {
 				nback++;
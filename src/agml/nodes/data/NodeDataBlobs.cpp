@@ -0,0 +1,68 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#include "NodeData.cpp"
+#include "math/random.h"
+
+/**
+ * Synthetic gaussian mixture dataset, for load tests and clustering benchmarks.
+ * Properties :
+ *  - n, D : number of rows and dimension (default 1000 x 10)
+ *  - K : number of blobs (default 10), whose centers are uniformly drawn in [min,max[ (default [-10,10[)
+ *  - spread : standard deviation of each blob (default 1)
+ *  - seed : centers only depend on it, so that all data nodes share the same mixture ;
+ *           samples are further seeded by the node description (default 0)
+ *  - gen_threads : number of generator threads (default 4)
+ *  - centers_file : if set, the true centers are written there
+ */
+class NodeDataBlobs : public NodeData {
+public:
+	Matrix centers;
+
+	virtual Matrix generate_data() {
+		size_t n = get_property_int("n", 1000), D = get_property_int("D", 10), K = get_property_int("K", 10);
+		uint64_t seed = get_property_int("seed", 0);
+
+		centers.init(K, D);
+		random_fill_uniform(centers, K*D, get_property_float("min", -10), get_property_float("max", 10), seed);
+		if(has_property("centers_file")) centers.write(get_property("centers_file"));
+
+		Matrix X(n, D);
+		long t = get_time_ms();
+		random_fill_blobs(X, n, D, centers, K, get_property_float("spread", 1), rng().next64(), get_property_int("gen_threads", 4));
+		DBG("Generated " << n << "x" << D << " blobs (K=" << K << ") in " << (get_time_ms()-t) << "ms");
+		return X;
+	}
+};
+
+AGML_NODE_CLASS(NodeDataBlobs)
@@ -32,17 +32,37 @@ knowledge of the CeCILL license and that you accept its terms.
 */
 
 #include "NodeData.cpp"
+#include "io/FileLoader.h"
 
+/**
+ * Properties :
+ *  - file : the vectors file to load
+ *  - io_threads : number of threads decoding the file (default 4)
+ *  - cache = off|on|refresh : keep a binary copy of parsed text files in ~/.agml/cache (default on)
+ *  - cache_dir : overrides the cache location
+ */
 class NodeDataFile : public NodeData {
 public:
 	std::string file;
+	FileLoader* loader;
 
 public:
+	NodeDataFile() { loader = 0; }
+	virtual ~NodeDataFile() { delete loader; }
+
 	virtual Matrix generate_data() {
 		file = get_property("file");
-		Matrix X;
-		X.read(file);
-		return X;
+		std::string cache = has_property("cache") ? get_property("cache") : "on";
+		loader = new FileLoader(file, get_property_int("io_threads", 4),
+				cache=="off" ? FILELOADER_CACHE_OFF : cache=="refresh" ? FILELOADER_CACHE_REFRESH : FILELOADER_CACHE_ON);
+		if(has_property("cache_dir")) loader->cache_dir = get_property("cache_dir");
+		loader->start();
+		return Matrix(loader->data, loader->height, loader->width);
+	}
+
+	virtual bool is_ready(size_t from, size_t to) {
+		if(loader->bError) AGML_FATAL_ERROR("NodeDataFile : " << loader->error);
+		return loader->is_ready(from, to);
 	}
 };
 
@@ -33,13 +33,19 @@ knowledge of the CeCILL license and that you accept its terms.
 
 
 #include "NodeData.cpp"
+#include "math/random.h"
 
+/**
+ * Uniform random dataset of n rows in dimension D, drawn in [min,max[.
+ * Generation is seeded by (seed, node description) and runs on gen_threads threads.
+ */
 class NodeDataRand : public NodeData {
 public:
 
 	virtual Matrix generate_data() {
 		Matrix X(get_property_int("n", 10), get_property_int("D", 10));
-		X.randf(get_property_float("min", 0), get_property_float("max", 1));
+		random_fill_uniform(X, X.height*X.width, get_property_float("min", 0), get_property_float("max", 1),
+				rng().next64(), get_property_int("gen_threads", 4));
 		return X;
 	}
 
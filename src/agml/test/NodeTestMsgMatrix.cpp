@@ -70,7 +70,7 @@ public:
 		X.dump();
 		DBG(idd);
 		if(get_nb_outs()>0){
-			int i = rand()%get_nb_outs();
+			int i = rng().uniform(get_nb_outs());
 			Message m(AGML_CHANNEL_CODEBOOK);
 			message_add_matrix(m, X);
 			m.add(idd);
@@ -58,6 +58,8 @@ private:
 
 public:
 
+	NodeEM() { M = 10; D = n = 0; nb_E_step = nb_M_step = 0; verbose = 0; m = 0; }
+
 	virtual void init() {
 		verbose = get_property_int("verbose",0);
 		M = get_property_int("M", 10);
@@ -76,8 +78,8 @@ public:
 	virtual void process() {
 		if(!X) return;
 
-		if(m>=M || get_nb_outs()==0) {	E_step();	nb_E_step++; m = 0; }
-		else {		M_step();	nb_M_step++; m++;}
+		if(m>=M || get_nb_outs()==0) {	TRACE_SPAN("E_step");	E_step();	nb_E_step++; m = 0; }
+		else {		TRACE_SPAN("M_step");	M_step();	nb_M_step++; m++;}
 	}
 
 	virtual void on_receive(Message* m) {
@@ -55,18 +55,37 @@ protected:
 	float s_MSE_new;
 	float w0;
 
+	MatrixEncoder S_enc, w_enc;
+	MatrixDelta delta;
+
 	float MSE_old;
 	float epsilon_t;
 	float tepsilon;
 
 public:
 
+	NodeKMeans() {
+		set_combiner(AGML_CHANNEL_CODEBOOK, combine_codebooks);
+		set_loss_tolerant(AGML_CHANNEL_CODEBOOK);
+	}
+
+	/** Pending (S,w,s_MSE,w0) contributions simply add up */
+	static bool combine_codebooks(Message* into, Message* m) {
+		if(!message_combine_matrix(into, m) || !message_combine_matrix(into, m)) return false;
+		message_combine<float>(into, m);
+		message_combine<float>(into, m);
+		return true;
+	}
+
 	virtual void init() {
 		record_var_delete(MSE);
 		MSE = FLT_MAX;
 		epsilon = get_property_float("epsilon",0);
 		tepsilon = 0;
 		epsilon_t = 100;
+		S_enc.configure(this, "codebook");
+		w_enc.configure(this, "codebook");
+		delta.configure(this, "codebook");
 		NodeEM::init();
 
 		if(D>0 && !codebook) {
@@ -89,7 +108,7 @@ public:
 		S = 0; w = 0;
 		S_new = 0; w_new = 0;
 		for(uint i=0; i<n; i++) {
-			int argmin = rand()%K;
+			int argmin = rng().uniform(K);
 			S_new.row(argmin) += X.row(i);
 			w_new[argmin]++;
 		}
@@ -117,7 +136,7 @@ public:
 		if(MSE_old - MSE < epsilon) tepsilon++; else tepsilon=0;
 		if(tepsilon>=epsilon_t) {
 			Message m(AGML_FINISH);
-			for(int i = 0; i<get_nb_outs(); i++) send(i, m);
+			broadcast(m);
 			the_end();
 		}
 	}
@@ -167,17 +186,29 @@ public:
 		if(get_nb_outs()==0 || !S) return;
 		if(w0<0.00001) return;
 
-		S /= 2; w /= 2; s_MSE /= 2; w0 /= 2;
+		// Only the codewords which moved enough since we last sent them are gossiped (and halved)
+		const std::vector<uint32_t>* rows = delta.select(codebook);
+		scale_rows(rows, 0.5);
+		s_MSE /= 2; w0 /= 2;
 
 		Message m(AGML_CHANNEL_CODEBOOK);
-		message_add_matrix(m,S);
-		message_add_matrix(m,w);
+		message_add_matrix(m,S,rows,S_enc);
+		message_add_matrix(m,w,rows,w_enc);
 		m.add(s_MSE);
 		m.add(w0);
 
-		int i = rand()%get_nb_outs(); // get_rand_neighbor();
+		int i = rng().uniform(get_nb_outs()); // get_rand_neighbor();
 		if(!send(i, m)) {
-			S *= 2; w *= 2; s_MSE *= 2; w0 *= 2;
+			S_enc.rollback(); w_enc.rollback(); delta.rollback();
+			scale_rows(rows, 2); s_MSE *= 2; w0 *= 2;
+		}
+	}
+
+	void scale_rows(const std::vector<uint32_t>* rows, float f) {
+		if(!rows) { S *= f; w *= f; return; }
+		for(size_t i=0; i<rows->size(); i++) {
+			S.row((*rows)[i]) *= f;
+			w[(*rows)[i]] *= f;
 		}
 	}
 
@@ -199,6 +230,11 @@ public:
 		} else NodeEM::on_receive(m);
 	}
 
+	/** A lost codebook update is added back, so that the gossiped sums keep their mass */
+	virtual void on_dropped(Message* m) {
+		if(m->channel == AGML_CHANNEL_CODEBOOK) on_receive(m);
+	}
+
 	virtual void on_request(const std::string& what, Message* m) {
 		if(what=="save") {
 			save_codebook();
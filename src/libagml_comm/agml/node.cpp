@@ -46,42 +46,34 @@ char DATA[SIZE];
 
 Node::Node() {
 	bInited = false;
-	infos = NULL;
 	id = -1;
 	thread = 0;
 	node_group = 0;
 	host = NULL;
 	bAttached = false;
 	bFinished = false;
+	mailbox_nb = mailbox_bytes = 0;
 }
 
 Node::~Node() {}
 
 void Node::_init() {
-	std::string f = TOSTRING("/agml_" << node_group->name << "@" << host->host->host_name << "_" << thread->id << "_node_" << id << ".log");
-	infos = (NodeInfo*) shared_mem(f, sizeof(NodeInfo));
-	if(!infos) throw std::runtime_error(TOSTRING("Couldn't init shared memory for NodeInfo : " << f));
-	infos->init();
+	_rng.seed(get_property_int("seed", 0), get_desc());
+
+	stats = stats_alloc_node(thread->id);
+	stats.init();
+	stats.node() = com_encode_local_node(this);
 
 	try {init();}
 	catch(AgmlException_Fatal& e) {	ERROR("FATAL ERROR in init() :  node " << dump() << " : " << e.what()); exit(1);}
 	catch(AgmlException_Warning& e) {	ERROR("WARNING in init() :  node " << dump() << " : " << e.what()); }
 	catch(std::exception& e) {	ERROR("ERROR in init() : node " << dump() << " : " << e.what());	}
+	thread->on_node_init();
 }
 
 void Node::_process() {
-	long t = get_time_ms();
-	if(t-infos->lasttime > 1000) {
-		infos->ips = ((int)(infos->nbprocess_second)*10/((t-infos->lasttime)/1000))/10.0;
-		infos->Ko_s = ((long)(infos->Ko_second*10)/((t-infos->lasttime)))/10.0;
-		infos->Ko_r = ((long)(infos->Ko_r_second*10)/((t-infos->lasttime)))/10.0;
-		infos->lasttime = t;
-		infos->nbprocess_second = 0;
-		infos->Ko_second = 0;
-		infos->Ko_r_second = 0;
-	}
-	infos->nbprocess_second++;
-	infos->nbProcess++;
+	TRACE_SPAN_OF("process", node_group->nodeclass.c_str());
+	stats.nb_process()++;
 	host->on_process();
 
 	try {process();}
@@ -97,18 +89,34 @@ long Node::get_nb_outs() {
 
 
 bool Node::send(int iNeighbor, Message& m) {
+	m.t_sent = (thread->nb_sent++ & LATENCY_MESSAGE_SAMPLING) ? 0 : get_time_us();
 	if(!node_group->send_out(this, iNeighbor, m)) return false;
-	infos->nbSend++;
-	infos->Ko_second+=m.total_size;
+	stats.nb_sent()++;
+	stats.bytes_sent()+=m.total_size;
 	host->on_send(m.total_size);
 	return true;
 }
 
+int Node::broadcast(Message& m) {
+	m.t_sent = (thread->nb_sent++ & LATENCY_MESSAGE_SAMPLING) ? 0 : get_time_us();
+	int nb = node_group->broadcast(this, m);
+	stats.nb_sent() += nb;
+	stats.bytes_sent() += nb*m.total_size;
+	host->on_send(nb*m.total_size);
+	return nb;
+}
+
 void Node::_receive(Message* m) {
+	TRACE_SPAN_OF("receive", node_group->nodeclass.c_str());
 	m->begin();
 	if(!bInited) {bInited=true;_init();}
-	infos->nbRecv++;
-	infos->Ko_r_second+=m->total_size;
+	if(m->src==AGML_DROPPED) {
+		try {on_dropped(m);}
+		catch(std::exception& e) {	ERROR("ERROR in on_dropped() : node " << dump() << " : " << e.what());	}
+		return;
+	}
+	stats.nb_recv()++;
+	stats.bytes_recv()+=m->total_size;
 	host->on_receive(m->total_size);
 
 	try {on_receive(m);}
@@ -148,14 +156,14 @@ void Node::attach() {
 	if(bAttached) return;
 	thread->attach(this);
 	bAttached = true;
-	if(infos) infos->bAttached = true;
+	if(stats.valid()) stats.bAttached() = true;
 }
 
 void Node::detach() {
 	if(!bAttached) return;
 	thread->detach(this);
 	bAttached = false;
-	if(infos) infos->bAttached = false;
+	if(stats.valid()) stats.bAttached() = false;
 }
 
 void Node::finish() {
@@ -164,5 +172,5 @@ void Node::finish() {
 	thread->remove(this);
 }
 
-void Node::set_info_1(float val) { infos->var1 = val; }
-void Node::set_info_2(float val) { infos->var2 = val; }
+void Node::set_info_1(float val) { stats.var1() = val; }
+void Node::set_info_2(float val) { stats.var2() = val; }
@@ -36,7 +36,13 @@ knowledge of the CeCILL license and that you accept its terms.
 
 #include "../common/Message.h"
 #include "../util/utils.h"
+#include "../util/rng.h"
+#include "../util/trace.h"
+#include "../topology/Stats.h"
 #include <string>
+#include <map>
+#include <set>
+#include <new>
 #define INTERNAL
 
 class Node;
@@ -47,7 +53,10 @@ class NodeInfo;
 class Message;
 
 
-#define AGML_NODE_CLASS(cls) 	extern "C" { Node* __agml_node_instanciator_##cls() { return new cls(); } }
+/** Exports the factories of a node class : plain, in place (for contiguous bulk instantiation) and its object size */
+#define AGML_NODE_CLASS(cls) 	extern "C" { Node* __agml_node_instanciator_##cls() { return new cls(); } \
+									 Node* __agml_node_placer_##cls(void* p) { return new(p) cls(); } \
+									 size_t __agml_node_size_##cls() { return sizeof(cls); } }
 
 
 #define AGML_FATAL_ERROR(x) throw AgmlException_Fatal(TOSTRING(x))
@@ -55,6 +64,13 @@ class Message;
 #define AGML_WARNING(x) throw AgmlException_Warning(TOSTRING(x))
 
 
+/**
+ * Merges pending message m into pending message into (same destination, channel and size), in place.
+ * Both messages are rewound before the call. Returns false if they can't be merged.
+ */
+typedef bool (*MessageCombiner)(Message* into, Message* m);
+
+
 #define record_var(x) _record_var(#x, x)
 #define record_var_delete(x) _record_var_del(#x, x)
 
@@ -71,11 +87,16 @@ public:
 
 	std::string nodeclass;
 
-	NodeInfo* infos;
+	/** Our record in the stats region (allocated by _init()) */
+	NodeStats stats;
 
 private:
 	bool bAttached;
 	bool bFinished;
+	Rng _rng;
+	std::map<int, MessageCombiner> combiners;
+	std::set<int> loss_tolerant;
+	volatile long mailbox_nb, mailbox_bytes;	// Messages pending in the thread's mailbox for this node
 
 public:
 	Node();
@@ -86,10 +107,42 @@ public:
 	virtual void on_receive(Message* m) = 0;
 	virtual void on_request(const std::string& what, Message* out) {}
 
+	/** Called back with a loss-tolerant message its destination never acknowledged (e.g. to take back the mass it carried) */
+	virtual void on_dropped(Message* m) {}
+
 	long get_nb_outs();
 
+	/**
+	 * Node's own random generator, seeded from the "seed" property and the node description,
+	 * so that runs are reproducible. Only use it from the node's callbacks.
+	 */
+	inline Rng& rng() { return _rng; }
+
+	/**
+	 * Let queued messages of this channel be merged before delivery (e.g. additive push-sum updates).
+	 * Must be called from the node class constructor.
+	 */
+	inline void set_combiner(int channel, MessageCombiner c) { combiners[channel] = c; }
+	inline MessageCombiner get_combiner(int channel) {
+		if(combiners.empty()) return 0;
+		std::map<int, MessageCombiner>::iterator i = combiners.find(channel);
+		return i==combiners.end() ? 0 : i->second;
+	}
+
+	/**
+	 * Messages of this channel may be lost, to the benefit of latency : with the group's "udp" property,
+	 * they travel as datagrams, and those which don't make it come back through on_dropped().
+	 * Must be called from the node class constructor.
+	 */
+	inline void set_loss_tolerant(int channel) { loss_tolerant.insert(channel); }
+	inline bool is_loss_tolerant(int channel) { return !loss_tolerant.empty() && loss_tolerant.count(channel); }
+
+	/** @return false if m couldn't be delivered (error, full mailbox or no network credit left) : the caller still owns its content */
 	bool send(int iNeighbor, Message& m);
 
+	/** Sends m to all out-neighbours, serializing it once per remote host. @return the number of Nodes reached */
+	int broadcast(Message& m);
+
 	inline bool send(int iNeighbor, int channel, const std::string& s) {
 		Message m(0,0,channel,(const unsigned char*)s.c_str(),s.length()+1);
 		return send(iNeighbor, m);
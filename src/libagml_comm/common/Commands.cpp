@@ -39,9 +39,14 @@ knowledge of the CeCILL license and that you accept its terms.
 #include "../topology/TopologyReader.h"
 #include "../topology/Info.h"
 #include "../topology/DataHost.h"
+#include "Udp.h"
+#include "../util/trace.h"
 
 extern array<DataHost*> data_hosts;
 
+/** How long (ms) the root waits for hosts to join before spreading the model */
+#define MODEL_JOIN_TIMEOUT 2000
+
 
 
 ////////////////////////////
@@ -126,6 +131,20 @@ void agml_command_root_welcome(Host* root, const char* params, size_t n) {
 	DBG(com_dump_hosts());
 }
 
+/** Hosts we invite take us as their root : we relay their requests to the real one */
+void agml_command_join_subtree(Host* h, const char* params, size_t n) {
+	std::istringstream iss(params);
+	std::vector<std::string> ips;
+	std::string ip;
+	while(iss >> ip) ips.push_back(ip);
+	DBG("Invite " << ips.size() << " hosts below us");
+	com_add_to_network(ips, 0);
+}
+
+void agml_command_host_ready(Host* h, const char* host, size_t n) {
+	com_on_host_ready(host);
+}
+
 
 //////////////////
 // DATA STREAMS //
@@ -140,15 +159,15 @@ void agml_command_model(Host* h, const char* topology, size_t n) {
 		std::istringstream f(topology);
 		TopologyReader tr(f);
 		tr.read_hosts();
+		std::vector<std::string> ips;
 		for(uint i=0; i<data_hosts.size(); i++) {
 			DBG(" - " << data_hosts[i]->host_name << " (ip=" << data_hosts[i]->server_ip << ")"
 					<< (data_hosts[i]->is_local() ? " <- ME" : ""));
-			if(data_hosts[i]->is_local()) continue;
-			try {
-				Host* h = com_add_to_network(data_hosts[i]->server_ip);
-				h->send_sys_command("root_welcome", TOSTRING(SERVER_PORT));
-			} catch(std::exception& e) { ERROR("ERROR : " << e.what()); }
+			if(!data_hosts[i]->is_local()) ips.push_back(data_hosts[i]->server_ip);
 		}
+		com_expect_hosts(ips.size());
+		// Slow hosts don't hold the others back : they get the topology whenever they join
+		if(!com_add_to_network(ips, MODEL_JOIN_TIMEOUT)) DBG("Some hosts are still joining, starting without them");
 	}
 
 	// If root, starts flooding the network with our topology
@@ -160,11 +179,13 @@ void agml_command_model(Host* h, const char* topology, size_t n) {
 
 void agml_command_set_topology(Host* h, const char* topology, size_t n) {
 	DBG("Update Topology ... ");
-	com_send_command_slaves("set_topology", topology);
+	com_send_topology_slaves(topology);
 	if(!Topology::cur) Topology::cur = new Topology();
 	//DBG("\n\n________________________________\n" << topology << "\n___________________________\n\n");
 	std::istringstream s(topology);
 	Topology::cur->read(s);
+	com_on_topology_ready();
+	if(!AGML_IS_ROOT()) com_on_host_ready(TOSTRING(SERVER_IP << ":" << SERVER_PORT));
 	DBG("\n\x1b[34mTopology successfully updated");	Topology::cur->dump_groups();	DBG("\x1b[0m\n");
 }
 
@@ -174,6 +195,43 @@ void agml_command_data_host(Host* h, const char* host_name, size_t n) {
 	if(!dh) dh = new DataHost(host_name, h->server_ip);
 	dh->host = h;
 	h->data_host = dh;
+	h->peer = dh;
+	h->send_sys_command("credit", TOSTRING(AGML_NET_CREDITS));
+}
+
+void agml_command_credit(Host* h, const char* params, size_t n) {
+	h->primary()->grant_credits(TOINT(params));
+}
+
+void agml_command_data_stream(Host* h, const char* host_name, size_t n) {
+	DataHost* dh = agml_get_datahost(host_name);
+	if(!dh) dh = new DataHost(host_name, h->server_ip);
+	h->peer = dh;
+	dh->streams.add(h);
+}
+
+/**
+ * An offer is answered by a switch to the best common version, which the peer answers by switching as well.
+ * Peers unaware of these commands ignore the offer, and both sides keep the legacy format.
+ */
+void agml_command_wire_offer(Host* h, const char* params, size_t n) {
+	h->switch_wire(MIN(TOINT(params), AGML_WIRE_VERSION));
+}
+
+void agml_command_wire_switch(Host* h, const char* params, size_t n) {
+	int version = TOINT(params);
+	h->read_version = version;
+	if(h->write_version != version) h->switch_wire(version);
+}
+
+void agml_command_udp_query(Host* h, const char* params, size_t n) {
+	std::string s = params;
+	udp_on_query(h, (unsigned short)TOINT(str_before(s, " ")), strtoull(str_after(s, " ").c_str(), NULL, 10));
+}
+
+void agml_command_udp_answer(Host* h, const char* params, size_t n) {
+	std::string s = params;
+	udp_on_answer(h, strtoull(str_before(s, " ").c_str(), NULL, 10), TOINT(str_after(s, " "))!=0);
 }
 
 
@@ -188,6 +246,7 @@ void agml_command_start_infos(Host* h, const char* params, size_t n) {
 }
 
 void agml_command_do_start_infos(Host* h, const char* params, size_t n) {
+	com_send_command_slaves("do_start_infos", params);
 	agml_infos_start_update_thread(params);
 }
 
@@ -238,6 +297,13 @@ void agml_process_infos_reply(const unsigned char* data, size_t size) {
 			std::cout << "          \"infos\" : ";
 			info->dump_JSON();
 			std::cout << ",\n";
+			std::cout << "          \"latency\" : [";
+			size_t nb_latency = ptrstream_read<size_t>(data);
+			for(uint l=0; l<nb_latency; l++) {
+				std::cout << (l!=0 ? ",\n              " : "\n              ");
+				ptrstream_read_ptr<LatencySummary>(data)->dump_JSON();
+			}
+			std::cout << " ],\n";
 			std::cout << "          \"nodes\" : [\n";
 			for(uint k=0; k<nb_nodes; k++) {
 				if(k!=0) std::cout << ",\n";
@@ -255,6 +321,34 @@ void agml_process_infos_reply(const unsigned char* data, size_t size) {
 }
 
 
+
+/////////////
+// TRACING //
+/////////////
+
+void agml_command_trace(Host* h, const char* params, size_t n) {
+	if(AGML_IS_ROOT()) agml_command_do_trace(h, params, n);
+	else com_send_command_masters("trace", params);
+}
+
+/** Each daemon writes its own trace, as <directory>/agml_trace_<port>.json */
+void agml_command_do_trace(Host* h, const char* params, size_t n) {
+	com_send_command_slaves("do_trace", params);
+	std::string s = str_trim(params ? params : "");
+	if(str_starts_with(s, "start")) {
+		trace_start(AGML_TRACE_EVENTS);
+		DBG("Tracing started");
+	} else if(str_starts_with(s, "stop")) {
+		trace_stop();
+		std::string dir = str_trim(str_after(s, "stop"));
+		std::string path = TOSTRING((dir.empty() ? "." : dir) << "/agml_trace_" << SERVER_PORT << ".json");
+		long nb = trace_write(path, SERVER_PORT, TOSTRING(SERVER_IP << ":" << SERVER_PORT));
+		if(nb<0) ERROR("ERROR : Couldn't write the trace to " << path);
+		else DBG("Trace written to " << path << " (" << nb << " spans)");
+	} else ERROR("Unknown trace command : " << s << " (expected start or stop [directory])");
+}
+
+
 ///////////////////
 // NODE REQUESTS //
 ///////////////////
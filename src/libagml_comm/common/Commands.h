@@ -79,6 +79,12 @@ void agml_command_root_welcome(Host* host, const char* params, size_t n);
 /** Request a Model */
 void agml_command_model(Host* host, const char* params, size_t n);
 
+/** Invite the given hosts below us in the network tree */
+void agml_command_join_subtree(Host* host, const char* params, size_t n);
+
+/** A host of the network has read the Topology */
+void agml_command_host_ready(Host* host, const char* params, size_t n);
+
 
 //////////////////
 // DATA STREAMS //
@@ -90,6 +96,24 @@ void agml_command_set_topology(Host* host, const char* params, size_t n);
 /** Connects a new data host */
 void agml_command_data_host(Host* h, const char* params, size_t n);
 
+/** Flow control : the peer grants us more data messages */
+void agml_command_credit(Host* h, const char* params, size_t n);
+
+/** Connects an additional stream to a data host */
+void agml_command_data_stream(Host* h, const char* params, size_t n);
+
+/** Wire format negotiation : the peer can read formats up to the given version */
+void agml_command_wire_offer(Host* h, const char* params, size_t n);
+
+/** Wire format negotiation : the peer writes in the given format from now on */
+void agml_command_wire_switch(Host* h, const char* params, size_t n);
+
+/** The peer asks what we did with one of its datagrams ("port seq"), see Udp.h */
+void agml_command_udp_query(Host* h, const char* params, size_t n);
+
+/** Answer to agml_command_udp_query() : "seq applied" */
+void agml_command_udp_answer(Host* h, const char* params, size_t n);
+
 
 ///////////
 // INFOS //
@@ -113,6 +137,17 @@ void agml_command_infos_reply(Host* h, const char* params, size_t n);
 void agml_process_infos_reply(const unsigned char* data, size_t size);
 
 
+/////////////
+// TRACING //
+/////////////
+
+/** Request all hosts to start tracing ("start") or to stop and write their trace ("stop [directory]") */
+void agml_command_trace(Host* h, const char* params, size_t n);
+
+/** Start or stop tracing, here and below us */
+void agml_command_do_trace(Host* h, const char* params, size_t n);
+
+
 
 ///////////////////
 // NODE REQUESTS //
@@ -36,26 +36,44 @@ knowledge of the CeCILL license and that you accept its terms.
 #include "../simulation/Thread.h"
 #include "../topology/Topology.h"
 #include "../topology/DataHost.h"
+#include <string.h>
+#include <sched.h>
+#include <errno.h>
+#include <vector>
+#include <algorithm>
 
 
 Host::Host() {
 	data_host = NULL;
+	peer = NULL;
 	server_ip = "";
 	thread = 0;
 	bIsCommandsChannel = false;
 	socket = 0;
 	id = 0;
 	next_node_id = 0;
+	credits = -1;
+	nb_consumed = 0;
+	write_next = write_serving = 0;
+	write_commands = 0;
+	read_version = write_version = AGML_WIRE_LEGACY;
 }
 
 Host::Host(Socket* s, bool _bIsCommandsChannel) {
 	LOCK();
 	data_host = NULL;
+	peer = NULL;
 	server_ip = TOSTRING(s->ip << ":" << s->port);
 	bIsCommandsChannel = _bIsCommandsChannel;
 	id = 0;
 	next_node_id = 0;
+	credits = -1;
+	nb_consumed = 0;
+	write_next = write_serving = 0;
+	write_commands = 0;
+	read_version = write_version = AGML_WIRE_LEGACY;
 	socket = s;
+	if(AGML_NET_URING) s->enable_uring();
 
 	if(s->isClient()) {
 		create_connection_thread();
@@ -66,12 +84,14 @@ Host::Host(Socket* s, bool _bIsCommandsChannel) {
 
 Host::~Host() {
 	LOCK();
-	if(data_host) delete data_host;
+	// data_host stays registered : the topology and our peer's other connections refer to it
 	data_host = NULL;
 	//		DBG("Host leaved the network : " << get_ip());
 	if(socket) delete socket;
 	socket = 0;
 	UNLOCK();
+	pthread_cond_destroy(&credits_cond);
+	pthread_cond_destroy(&write_turn);
 }
 
 
@@ -131,30 +151,335 @@ void Host::send_command(int command, const unsigned char* data, size_t size) {
 }
 
 void Host::send(const std::string& rawmsg) {
-	LOCK();
+	LOCK_WRITE(true);
 	socket->write(rawmsg);
-	UNLOCK();
+	UNLOCK_WRITE(true);
 }
 
 void Host::recv(Message* m) {
 	m->read(this);
 }
 
+/**
+ * Commands go through the main connection. Smaller data messages to a given Node always take the same stream, while
+ * the fragments of large ones are striped across all of them : data messages are then ranked per destination Node,
+ * for our peer to deliver them in order (see Reassembler::order).
+ */
 void Host::send(Message* m) {
-	LOCK();
-	if(!socket) throw std::runtime_error(TOSTRING("Couldn't send to host " << server_ip));
-	else m->write(socket);
-	UNLOCK();
+	TRACE_SPAN("send");
+	if(m->is_sys_command()) { write(m); return; }
+	bool bStriped = is_striped();
+	m->seq = 0;
+	if(bStriped) {
+		pthread_mutex_lock(&seqs_mut);
+		m->seq = ++seqs[m->dst];
+		pthread_mutex_unlock(&seqs_mut);
+	}
+	if(m->total_size > (size_t)AGML_NET_FRAGMENT) send_fragmented(m, bStriped);
+	else get_stream((size_t)(m->dst ^ (m->dst >> 32)))->write(m);
+}
+
+/** @return true if we have several streams to our peer, which all carry message ranks */
+bool Host::is_striped() {
+	if(!peer || peer->host!=this || write_version < AGML_WIRE_ORDERED) return false;
+	array<Host*>::snapshot streams(peer->streams);
+	if(streams.size()==0) return false;
+	for(uint i=0; i<streams.size(); i++) if(streams[i]->write_version < AGML_WIRE_ORDERED) return false;
+	return true;
 }
 
+void Host::write(Message* m) {
+	bool bCommand = m->is_sys_command();
+	LOCK_WRITE(bCommand);
+	if(!socket) { UNLOCK_WRITE(bCommand); throw std::runtime_error(TOSTRING("Couldn't send to host " << server_ip)); }
+	m->write(socket, write_version);
+	UNLOCK_WRITE(bCommand);
+}
+
+void Host::switch_wire(int version) {
+	std::string v = TOSTRING(version);
+	Message m((long)-1, (long)-1, AGML_COMMAND_ID("wire_switch"), (const unsigned char*)v.c_str(), v.length()+1);
+	LOCK_WRITE(true);
+	if(!socket) { UNLOCK_WRITE(true); throw std::runtime_error(TOSTRING("Couldn't send to host " << server_ip)); }
+	m.write(socket, write_version);
+	write_version = version;
+	UNLOCK_WRITE(true);
+}
+
+/** @return the i-th (modulo) connection to our peer, counting the main one */
+Host* Host::get_stream(size_t i) {
+	if(!peer || peer->host!=this) return this;
+	array<Host*>::snapshot streams(peer->streams);
+	i %= streams.size()+1;
+	return i==0 ? this : streams[i-1];
+}
+
+Host* Host::primary() {
+	return peer && peer->host ? peer->host : this;
+}
+
+
+///////////////////
+// FRAGMENTATION //
+///////////////////
+
+struct FragmentHead { long src, dst; int channel; size_t nb_data; };
+
+static volatile long next_fragmented_id = 0;
+
+/**
+ * Large messages are cut into frames of about AGML_NET_FRAGMENT bytes, each written under the lock on its own,
+ * so that other senders' messages interleave with them instead of waiting for the whole transfer, control commands
+ * going right after the frame in progress (see LOCK_WRITE()). Frames point into m's data : nothing is copied.
+ * They are striped across the streams to our peer, unless it can't put messages back in order : they then all take
+ * the stream of m's destination Node.
+ * Each frame starts with the offset of its chunk in the concatenated data of m's elements ; the first one also
+ * carries m's header, rank and the sizes of its elements.
+ */
+void Host::send_fragmented(Message* m, bool bStriped) {
+	long id = __sync_fetch_and_add(&next_fragmented_id, 1);
+	size_t node_stream = (size_t)(m->dst ^ (m->dst >> 32));
+	FragmentHead head = { m->src, m->dst, m->channel, m->elts.size() };
+	std::vector<size_t> sizes;
+	for(std::list<MessageElt>::iterator i = m->elts.begin(); i!=m->elts.end(); i++) sizes.push_back((*i).data ? (*i).size : 0);
+
+	std::list<MessageElt>::iterator e = m->elts.begin();
+	size_t k = 0, offset = 0, pos = 0;
+	for(size_t nb = 0; e!=m->elts.end() || nb==0; nb++) {
+		Message f;
+		f.src = AGML_FRAGMENT;
+		f.dst = id;
+		f.channel = nb==0 ? AGML_FRAGMENT_FIRST : 0;
+		f.t_sent = m->t_sent;
+		if(nb==0) f.seq = m->seq;
+		size_t frame_pos = pos;
+		f.add(frame_pos);
+		if(nb==0) {
+			f.add((unsigned char*)&head, sizeof(head));
+			f.add((unsigned char*)&sizes[0], sizes.size()*sizeof(size_t));
+		}
+		for(size_t room = AGML_NET_FRAGMENT; room>0 && e!=m->elts.end();) {
+			size_t n = MIN(room, sizes[k] - offset);
+			if(n>0) f.add((*e).data + offset, n);
+			offset += n; room -= n; pos += n;
+			if(offset==sizes[k]) { e++; k++; offset = 0; }
+		}
+
+		Host* s = get_stream(bStriped ? nb : node_stream);
+		s->LOCK_WRITE();
+		if(!s->socket) { s->UNLOCK_WRITE(); throw std::runtime_error(TOSTRING("Couldn't send to host " << s->server_ip)); }
+		f.write(s->socket, s->write_version);
+		s->UNLOCK_WRITE();
+	}
+}
+
+void Reassembly::discard_early() {
+	for(size_t i=0; i<early.size(); i++) delete early[i];
+	early.clear();
+	early_size = 0;
+}
+
+Reassembler::~Reassembler() {
+	for(std::map<long, Reassembly>::iterator i = pending.begin(); i!=pending.end(); i++) {
+		delete i->second.m;
+		i->second.discard_early();
+	}
+	for(std::map<long, Ordering>::iterator o = orders.begin(); o!=orders.end(); o++) {
+		for(std::map<long, Message*>::iterator i = o->second.held.begin(); i!=o->second.held.end(); i++) delete i->second;
+	}
+}
+
+/** @return why frame f can't be a first frame, NULL if it can */
+static const char* check_first_fragment(Message* f) {
+	if(f->elts.size() < 3) return "First fragment misses its header";
+	std::list<MessageElt>::iterator i = ++f->elts.begin();
+	if((*i).size != sizeof(FragmentHead)) return "Malformed fragment header";
+	FragmentHead* head = (FragmentHead*)(*i++).data;
+	if(head->nb_data != (*i).size/sizeof(size_t) || (*i).size % sizeof(size_t)) return "Fragment header doesn't match its element sizes";
+	size_t* sizes = (size_t*)(*i).data;
+	size_t total = 0;
+	for(size_t k=0; k<head->nb_data; k++) {
+		if(sizes[k] > (size_t)AGML_NET_MAX_MESSAGE - total) return "Fragmented message exceeds AGML_NET_MAX_MESSAGE";
+		total += sizes[k];
+	}
+	return NULL;
+}
+
+Message* Reassembler::on_fragment(Message* f, Host* from) {
+	long id = f->dst;
+	const char* error = NULL;
+	if(f->elts.empty() || f->elts.front().size != sizeof(size_t)) error = "Fragment misses its offset";
+	else if(f->channel & AGML_FRAGMENT_FIRST) error = check_first_fragment(f);
+	if(error) { delete f; throw std::runtime_error(error); }
+
+	pthread_mutex_lock(&mut);
+	Reassembly& r = pending[id];
+	if(f->channel & AGML_FRAGMENT_FIRST && !r.m) {
+		std::list<MessageElt>::iterator i = ++f->elts.begin();
+		FragmentHead* head = (FragmentHead*)(*i++).data;
+		size_t* sizes = (size_t*)(*i).data;
+		r.m = new Message();
+		r.m->src = head->src; r.m->dst = head->dst; r.m->channel = head->channel;
+		r.m->t_sent = f->t_sent;
+		r.m->seq = f->seq;
+		r.m->bDataAllocated = true;
+		for(size_t k=0; k<head->nb_data; k++) {
+			r.data.push_back(sizes[k] ? new unsigned char[sizes[k]] : NULL);
+			r.m->add(r.data.back(), sizes[k]);
+			r.total += sizes[k];
+			r.ends.push_back(r.total);
+		}
+		for(size_t i=0; i<r.early.size() && !error; i++) if(!write(r, r.early[i])) error = "Fragment overflow";
+		r.discard_early();
+	} else if(f->channel & AGML_FRAGMENT_FIRST) error = "Duplicate first fragment";
+
+	Message* m = NULL;
+	if(error) delete f;
+	else if(!r.m) {
+		// The first frame hasn't arrived yet : hold the frame, up to the size of the largest message we accept
+		r.early_size += f->total_size;
+		r.early.push_back(f);
+		if(r.early_size > (size_t)AGML_NET_MAX_MESSAGE) error = "Too many fragments ahead of their first one";
+	} else {
+		if(!write(r, f)) error = "Fragment overflow";
+		delete f;
+		if(!error && r.received==r.total) {
+			m = r.m;
+			m->from = from;
+			m->begin();
+			pending.erase(id);
+		}
+	}
+	if(error) {
+		delete r.m;
+		r.discard_early();
+		pending.erase(id);
+	}
+	pthread_mutex_unlock(&mut);
+	if(error) throw std::runtime_error(error);
+	return m;
+}
+
+/**
+ * Small messages only overtake each other while a large one is on its way : the messages to its Node are held
+ * until it completes. Deliveries happen under the lock, so that the streams' threads don't reorder them again.
+ */
+void Reassembler::order(Message* m, Host* h) {
+	pthread_mutex_lock(&mut);
+	Ordering& o = orders[m->dst];
+	long seq = m->seq;
+	if(seq > o.next) o.held[seq] = m;
+	else {
+		// Lower ranks than expected come from a former connection of the peer (see reset())
+		h->dispatch(m);
+		if(seq==o.next) {
+			for(o.next++; !o.held.empty() && o.held.begin()->first==o.next; o.next++) {
+				m = o.held.begin()->second;
+				o.held.erase(o.held.begin());
+				h->dispatch(m);
+			}
+		}
+	}
+	pthread_mutex_unlock(&mut);
+}
+
+void Reassembler::reset(Host* h) {
+	pthread_mutex_lock(&mut);
+	for(std::map<long, Reassembly>::iterator i = pending.begin(); i!=pending.end(); i++) {
+		delete i->second.m;
+		i->second.discard_early();
+	}
+	pending.clear();
+	// What they waited for was lost with the connections : deliver them anyway, still in order
+	for(std::map<long, Ordering>::iterator o = orders.begin(); o!=orders.end(); o++) {
+		for(std::map<long, Message*>::iterator i = o->second.held.begin(); i!=o->second.held.end(); i++) h->dispatch(i->second);
+	}
+	orders.clear();
+	pthread_mutex_unlock(&mut);
+}
+
+/** Copies the chunk of frame f where it belongs. @return false if it doesn't fit */
+bool Reassembler::write(Reassembly& r, Message* f) {
+	std::list<MessageElt>::iterator i = f->elts.begin();
+	size_t pos = *(size_t*)(*i++).data;
+	if(f->channel & AGML_FRAGMENT_FIRST) { i++; i++; }
+	for(; i!=f->elts.end(); i++) {
+		for(size_t done = 0; done < (*i).size;) {
+			size_t k = std::upper_bound(r.ends.begin(), r.ends.end(), pos) - r.ends.begin();
+			if(k>=r.ends.size()) return false;
+			size_t start = k ? r.ends[k-1] : 0;
+			size_t n = MIN((*i).size - done, r.ends[k] - pos);
+			memcpy(r.data[k] + pos - start, (*i).data + done, n);
+			done += n; pos += n; r.received += n;
+		}
+	}
+	return true;
+}
+
+bool Host::wait_credit(long timeout) {
+	if(take_credit()) return true;
+	struct timespec deadline = get_deadline(timeout);
+	bool bOk = false;
+	pthread_mutex_lock(&credits_mut);
+	while(!(bOk = take_credit())) {
+		if(pthread_cond_timedwait(&credits_cond, &credits_mut, &deadline)==ETIMEDOUT) { bOk = take_credit(); break; }
+	}
+	pthread_mutex_unlock(&credits_mut);
+	return bOk;
+}
+
+void Host::grant_credits(long n) {
+	pthread_mutex_lock(&credits_mut);
+	for(;;) {
+		long c = credits;
+		if(__sync_bool_compare_and_swap(&credits, c, (c<0 ? 0 : c) + n)) break;
+	}
+	pthread_cond_broadcast(&credits_cond);
+	pthread_mutex_unlock(&credits_mut);
+}
+
+/** Grant credits back to the peer by batches of half the window */
+void Host::on_consumed() {
+	long batch = AGML_NET_CREDITS/2;
+	if(__sync_add_and_fetch(&nb_consumed, 1) % batch == 0) {
+		try { send_sys_command("credit", TOSTRING(batch)); }
+		catch(std::exception& e) { ERROR("ERROR : Couldn't grant credits to " << server_ip << " : " << e.what()); }
+	}
+}
 
 void Host::on_receive(Message* m) {
+	if(peer) m->from = primary();
+	Reassembler& r = peer ? peer->reassembler : reassembler;
+	if(m->src==AGML_FRAGMENT && !(m = r.on_fragment(m, m->from))) return;
 	if(m->is_sys_command()) {
 		MessageElt& me = m->get_next();
 		AGML_COMMAND_EXEC(this, m->channel, (const char*)me.data, me.size);
 		delete m;
 	}
-	else com_decode_local_node(m->dst)->thread->push_message(m);
+	else if(m->seq) r.order(m, this);
+	else dispatch(m);
+}
+
+void Host::dispatch(Message* m) {
+	if(m->is_multicast()) {
+		// Fan out to the listed local Nodes. Only the original message returns a credit to the sender
+		MessageElt ids = m->pop_back();
+		size_t nb = ids.size/sizeof(long);
+		std::vector<Message*> copies(nb);
+		for(size_t i=0; i<nb; i++) {
+			copies[i] = (i+1==nb) ? m : m->copy();
+			if(copies[i]!=m) copies[i]->from = NULL;
+			copies[i]->dst = ((long*)ids.data)[i];
+		}
+		if(m->bDataAllocated) delete[] ids.data;
+		if(!nb) {
+			// Nothing to deliver : consumed right away
+			if(m->from) m->from->on_consumed();
+			delete m;
+		}
+		for(size_t i=0; i<nb; i++) com_deliver(copies[i]);
+	}
+	else com_deliver(m);
 }
 
 
@@ -38,10 +38,55 @@ knowledge of the CeCILL license and that you accept its terms.
 #include "com.h"
 #include "../util/utils.h"
 #include <pthread.h>
+#include <map>
+#include <vector>
 
 
 class DataHost;
 
+/** A fragmented message being received (see Host::send) */
+class Reassembly {
+public:
+	Message* m;
+	std::vector<unsigned char*> data;
+	std::vector<size_t> ends;		// end offset of each element in the concatenated data
+	size_t total, received;
+	std::vector<Message*> early;	// frames received before the first one
+	size_t early_size;				// and their total size
+	Reassembly() : m(0), total(0), received(0), early_size(0) {}
+	void discard_early();
+};
+
+/** The ranked messages to a Node, waiting for those sent before them (see Message::seq) */
+class Ordering {
+public:
+	long next;
+	std::map<long, Message*> held;
+	Ordering() : next(1) {}
+};
+
+/**
+ * Reassembles the fragmented messages coming from one peer, whichever of its streams their frames took,
+ * and delivers its ranked messages to each Node in the order they were sent
+ */
+class Reassembler {
+public:
+	pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+	std::map<long, Reassembly> pending;
+	std::map<long, Ordering> orders;
+
+	~Reassembler();
+
+	/** @return the reassembled message once frame f completes it, NULL otherwise */
+	Message* on_fragment(Message* f, Host* from);
+	/** Delivers m through h, after the messages sent to the same Node before it, then the held ones it was the last to wait for */
+	void order(Message* m, Host* h);
+	/** Once the connections from the peer are all closed : drops the partial messages and delivers the held ones through h */
+	void reset(Host* h);
+private:
+	bool write(Reassembly& r, Message* f);
+};
+
 class Host {
 public:
 	int id;
@@ -54,6 +99,29 @@ public:
 	pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
 
 	DataHost* data_host;
+	/** The DataHost this connection (or additional stream) leads to, if any */
+	DataHost* peer;
+
+	/** Data messages we may still send to this host (-1 = unlimited, until the peer advertises credits) */
+	volatile long credits;
+	/** Signaled when credits are granted, to the senders waiting for some */
+	pthread_mutex_t credits_mut = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t credits_cond = PTHREAD_COND_INITIALIZER;
+	/** Data messages received from this host and consumed by our nodes */
+	volatile long nb_consumed;
+
+	/** Wire formats of the messages we read from and write to this connection (see Message.h) */
+	volatile int read_version, write_version;
+
+	/** Data writers take the socket in turn, by order of arrival, after the commands waiting for it (see LOCK_WRITE()) */
+	unsigned long write_next, write_serving;
+	volatile long write_commands;
+	pthread_cond_t write_turn = PTHREAD_COND_INITIALIZER;
+	/** Fragmented messages from a peer we don't know as a DataHost */
+	Reassembler reassembler;
+	/** Ranks of the last messages sent to each remote Node, while they are striped over several streams (see send()) */
+	std::map<long, long> seqs;
+	pthread_mutex_t seqs_mut = PTHREAD_MUTEX_INITIALIZER;
 public:
 	Host();
 	Host(Socket* s, bool _bIsCommandsChannel = false);
@@ -87,6 +155,28 @@ public:
 	inline void LOCK() {pthread_mutex_lock(&mut);}
 	inline void UNLOCK() {pthread_mutex_unlock(&mut);}
 
+	/**
+	 * Locks for writing to the socket. Data writers go after the ones that came first : each frame of a large message
+	 * queues behind the messages sent meanwhile, which interleave with it without starving it. Commands go before
+	 * all of them, only waiting for the write in progress.
+	 */
+	inline void LOCK_WRITE(bool bCommand = false) {
+		if(bCommand) {
+			__sync_add_and_fetch(&write_commands, 1);
+			LOCK();
+			return;
+		}
+		LOCK();
+		unsigned long t = write_next++;
+		while(t!=write_serving || write_commands) pthread_cond_wait(&write_turn, &mut);
+	}
+	inline void UNLOCK_WRITE(bool bCommand = false) {
+		if(bCommand) __sync_sub_and_fetch(&write_commands, 1);
+		else write_serving++;
+		if(write_next!=write_serving) pthread_cond_broadcast(&write_turn);
+		UNLOCK();
+	}
+
 
 	void subscribe();
 
@@ -124,16 +214,42 @@ public:
 		send_sys_command(id);
 	}
 
+	/** Flow control */
+	inline bool take_credit() {
+		for(;;) {
+			long c = credits;
+			if(c<0) return true;
+			if(c==0) return false;
+			if(__sync_bool_compare_and_swap(&credits, c, c-1)) return true;
+		}
+	}
+	/** Wait up to timeout ms for a credit */
+	bool wait_credit(long timeout);
+	void grant_credits(long n);
+	void on_consumed();
+
+	/** Announces (in the current format) that we write in format version from now on */
+	void switch_wire(int version);
+
+	/** @return the main connection to our peer (this, unless we are one of its additional streams) */
+	Host* primary();
+
 	/** Synchronous reception (wait for message) */
 	void recv(Message* m);
 
 	/** Asynchronous reception */
 	void on_receive(Message* m);
+	/** Hands a received data message over to its destination Node(s) */
+	void dispatch(Message* m);
 
 private:
 	int next_node_id;
 
 	void create_connection_thread();
+	Host* get_stream(size_t i);
+	bool is_striped();
+	void write(Message* m);
+	void send_fragmented(Message* m, bool bStriped);
 };
 
 
@@ -37,6 +37,10 @@ knowledge of the CeCILL license and that you accept its terms.
 #include "Message.h"
 #include "Host.h"
 #include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+#include <sys/uio.h>
 
 
 Message::Message() {
@@ -45,6 +49,8 @@ Message::Message() {
 	channel = 0;
 	bDataAllocated = false;
 	total_size = 0;
+	t_sent = t_queued = 0;
+	seq = 0;
 }
 
 Message::Message(int channel) {
@@ -53,6 +59,8 @@ Message::Message(int channel) {
 	src = dst = 0;
 	bDataAllocated = false;
 	total_size = 0;
+	t_sent = t_queued = 0;
+	seq = 0;
 }
 
 Message::Message(long src, long dst, int channel, const unsigned char* data, size_t size) {
@@ -64,6 +72,8 @@ Message::Message(long src, long dst, int channel, const unsigned char* data, siz
 	add((unsigned char*)data, size);
 	i = elts.begin();
 	bDataAllocated = false;
+	t_sent = t_queued = 0;
+	seq = 0;
 }
 
 Message::Message(Message& m) {
@@ -71,6 +81,9 @@ Message::Message(Message& m) {
 	src = m.src;
 	dst = m.dst;
 	channel = m.channel;
+	t_sent = m.t_sent;
+	t_queued = 0;
+	seq = m.seq;
 	elts = m.elts;
 	total_size = m.total_size;
 	bDataAllocated = m.bDataAllocated;
@@ -89,7 +102,50 @@ bool Message::is_sys_command() {
 	return src==((long)-1);
 }
 
-void Message::read(Socket* s) {
+/////////////////
+// WIRE FORMAT //
+/////////////////
+
+/**
+ * Compact format : src and dst as (zigzag group, node id) varint pairs, then
+ * varint(zigzag(channel)<<4 | nb_data) (nb_data>=15 follows as a varint), then each element as varint(size) + data.
+ * A gossip message carrying two floats takes 15 bytes instead of 54.
+ * From AGML_WIRE_TIMED on, the channel is followed by varint(t_sent), and from AGML_WIRE_ORDERED on by varint(seq).
+ */
+
+static inline uint64_t zigzag(long v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static inline long unzigzag(uint64_t v) { return (long)(v >> 1) ^ -(long)(v & 1); }
+
+static inline unsigned char* put_varint(unsigned char* p, uint64_t v) {
+	while(v >= 0x80) { *p++ = (unsigned char)(v | 0x80); v >>= 7; }
+	*p++ = (unsigned char)v;
+	return p;
+}
+
+static inline unsigned char* put_address(unsigned char* p, long a) {
+	p = put_varint(p, zigzag((int)(a >> 32)));
+	return put_varint(p, (uint32_t)a);
+}
+
+static uint64_t read_varint(Socket* s) {
+	uint64_t v = 0;
+	unsigned char b;
+	int shift = 0;
+	do {
+		s->read(&b);
+		v |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while((b & 0x80) && shift < 64);
+	return v;
+}
+
+static long read_address(Socket* s) {
+	long group = unzigzag(read_varint(s));
+	uint32_t id = (uint32_t)read_varint(s);
+	return (long)(((uint64_t)group << 32) | id);
+}
+
+void Message::read(Socket* s, int version) {
 	//	char magic[5];
 	//	h->socket->read_exactly(magic, 5);
 	//	if(strcmp(magic, "AGML")) {
@@ -97,15 +153,29 @@ void Message::read(Socket* s) {
 	//		exit(1);
 	//		throw std::runtime_error(TOSTRING("Wrong magic number : " << magic << " messages are in a mess !"));
 	//	}
-	s->read(&src);
-	s->read(&dst);
-	s->read(&channel);
-	ushort nb_data;
-	s->read(&nb_data);
-	for(ushort i = 0; i<nb_data; i++) {
+	size_t nb_data;
+	if(version>=AGML_WIRE_COMPACT) {
+		src = read_address(s);
+		dst = read_address(s);
+		uint64_t c = read_varint(s);
+		channel = (int)unzigzag(c >> 4);
+		nb_data = c & 15;
+		if(nb_data==15) nb_data = read_varint(s);
+		if(version>=AGML_WIRE_TIMED) t_sent = (long)read_varint(s);
+		if(version>=AGML_WIRE_ORDERED) seq = (long)read_varint(s);
+	} else {
+		s->read(&src);
+		s->read(&dst);
+		s->read(&channel);
+		ushort nb;
+		s->read(&nb);
+		nb_data = nb;
+	}
+	for(size_t i = 0; i<nb_data; i++) {
 		size_t size = 0;
 		unsigned char* data = 0;
-		s->read(&size);
+		if(version>=AGML_WIRE_COMPACT) size = read_varint(s);
+		else s->read(&size);
 		if(size>0) {
 			data = new unsigned char[size];
 			bDataAllocated = true;
@@ -118,11 +188,12 @@ void Message::read(Socket* s) {
 
 void Message::read(Host* h) {
 	from = h;
-	read(h->socket);
+	read(h->socket, h->read_version);
 }
 
-void Message::write(Socket* s) {
+void Message::write(Socket* s, int version) {
 	from = NULL;
+	if(version>=AGML_WIRE_COMPACT) { write_compact(s, version); return; }
 //	s->write("AGML");
 	s->write(src);
 	s->write(dst);
@@ -139,6 +210,98 @@ void Message::write(Socket* s) {
 	}
 }
 
+/** The whole message goes in a single gathered write */
+void Message::write_compact(Socket* s, int version) {
+	size_t nb = elts.size();
+	unsigned char hdr_local[256];
+	struct iovec iov_local[33];
+	std::vector<unsigned char> hdr_big;
+	std::vector<struct iovec> iov_big;
+	unsigned char* hdr = hdr_local;
+	struct iovec* iov = iov_local;
+	if(nb > 16) {
+		hdr_big.resize(64 + 10*nb); hdr = &hdr_big[0];
+		iov_big.resize(2*nb + 1); iov = &iov_big[0];
+	}
+
+	unsigned char* p = hdr, *start = hdr;
+	int n = 0;
+	p = put_address(p, src);
+	p = put_address(p, dst);
+	p = put_varint(p, (zigzag(channel) << 4) | MIN(nb, (size_t)15));
+	if(nb>=15) p = put_varint(p, nb);
+	if(version>=AGML_WIRE_TIMED) p = put_varint(p, t_sent > 0 ? t_sent : 0);
+	if(version>=AGML_WIRE_ORDERED) p = put_varint(p, seq > 0 ? seq : 0);
+	for(std::list<MessageElt>::iterator i = elts.begin(); i!=elts.end(); i++) {
+		size_t size = (*i).data ? (*i).size : 0;
+		p = put_varint(p, size);
+		if(!size) continue;
+		iov[n].iov_base = start; iov[n++].iov_len = p - start;
+		iov[n].iov_base = (*i).data; iov[n++].iov_len = size;
+		start = p;
+	}
+	if(p>start) { iov[n].iov_base = start; iov[n++].iov_len = p - start; }
+	s->writev(iov, n);
+}
+
+size_t Message::pack(unsigned char* buf, size_t max) {
+	size_t nb = elts.size();
+	if(max < 48) return 0;
+	unsigned char* p = buf, *end = buf + max;
+	p = put_address(p, src);
+	p = put_address(p, dst);
+	p = put_varint(p, (zigzag(channel) << 4) | MIN(nb, (size_t)15));
+	if(nb>=15) p = put_varint(p, nb);
+	for(std::list<MessageElt>::iterator i = elts.begin(); i!=elts.end(); i++) {
+		size_t size = (*i).data ? (*i).size : 0;
+		if(size + 10 > (size_t)(end - p)) return 0;
+		p = put_varint(p, size);
+		if(size) memcpy(p, (*i).data, size);
+		p += size;
+	}
+	return p - buf;
+}
+
+static inline bool get_varint(const unsigned char*& p, const unsigned char* end, uint64_t& v) {
+	v = 0;
+	for(int shift = 0; shift < 64; shift += 7) {
+		if(p==end) return false;
+		unsigned char b = *p++;
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if(!(b & 0x80)) return true;
+	}
+	return false;
+}
+
+static inline bool get_address(const unsigned char*& p, const unsigned char* end, long& a) {
+	uint64_t group, id;
+	if(!get_varint(p, end, group) || !get_varint(p, end, id)) return false;
+	a = (long)(((uint64_t)unzigzag(group) << 32) | (uint32_t)id);
+	return true;
+}
+
+bool Message::unpack(const unsigned char* buf, size_t len) {
+	const unsigned char* p = buf, *end = buf + len;
+	uint64_t c, nb_data, size;
+	if(!get_address(p, end, src) || !get_address(p, end, dst) || !get_varint(p, end, c)) return false;
+	channel = (int)unzigzag(c >> 4);
+	nb_data = c & 15;
+	if(nb_data==15 && !get_varint(p, end, nb_data)) return false;
+	bDataAllocated = true;
+	for(uint64_t i = 0; i<nb_data; i++) {
+		if(!get_varint(p, end, size) || size > (uint64_t)(end - p)) return false;
+		unsigned char* data = 0;
+		if(size) {
+			data = new unsigned char[size];
+			memcpy(data, p, size);
+			p += size;
+		}
+		add(data, size);
+	}
+	this->i = elts.begin();
+	return p==end;
+}
+
 std::string Message::dump() {
 	return TOSTRING("from : " << from->server_ip << " : " << src << "->" << dst << " ch=" << channel << ", size=" << total_size);
 }
@@ -150,6 +313,18 @@ void Message::set_command(const std::string& cmd) {
 	else set_command(id);
 }
 
+void Message::swap(Message& m) {
+	std::swap(from, m.from);
+	std::swap(src, m.src);
+	std::swap(dst, m.dst);
+	std::swap(channel, m.channel);
+	std::swap(t_sent, m.t_sent);
+	elts.swap(m.elts);
+	std::swap(total_size, m.total_size);
+	std::swap(bDataAllocated, m.bDataAllocated);
+	begin(); m.begin();
+}
+
 Message* Message::copy() {
 	Message* m = new Message();
 	m->bDataAllocated = true;
@@ -157,6 +332,7 @@ Message* Message::copy() {
 	m->channel = channel;
 	m->dst = dst;
 	m->src = src;
+	m->t_sent = t_sent;
 	for(std::list<MessageElt>::iterator i = elts.begin(); i!=elts.end(); i++) {
 		size_t s = (*i).size;
 		unsigned char* buf = new unsigned char[s];
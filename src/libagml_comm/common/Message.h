@@ -43,6 +43,23 @@ knowledge of the CeCILL license and that you accept its terms.
 class Socket;
 class Host;
 
+/** Destination of messages bound to several Nodes of a host, listed in their last element (see NodeGroup::multicast) */
+#define AGML_MULTICAST ((long)-2)
+
+/** Source of the frames carrying a message larger than AGML_NET_FRAGMENT bytes (see Host::send) */
+#define AGML_FRAGMENT ((long)-3)
+#define AGML_FRAGMENT_FIRST 1
+
+/** Source of the loss-tolerant messages handed back to their sender, never acknowledged (see Node::on_dropped) */
+#define AGML_DROPPED ((long)-4)
+
+/** Wire formats, negotiated per connection (see Host::switch_wire) */
+#define AGML_WIRE_LEGACY 0		// fixed 22 bytes header, 8 bytes per element size
+#define AGML_WIRE_COMPACT 1		// varint addresses, channel and sizes
+#define AGML_WIRE_TIMED 2		// compact, plus the time the message was sent
+#define AGML_WIRE_ORDERED 3		// timed, plus the rank of the message among those to its destination Node
+#define AGML_WIRE_VERSION AGML_WIRE_ORDERED
+
 class MessageElt {
 public:
 	unsigned char* data;
@@ -58,6 +75,12 @@ public:
 	long src,dst;
 	int channel;
 
+	/** When the message was sent (get_time_us()) and queued for its destination node (get_monotonic_us()), 0 if not sampled */
+	long t_sent, t_queued;
+
+	/** Rank of the message among those sent to its destination Node over several streams, 0 if unranked (see Host::send) */
+	long seq;
+
 	std::list<MessageElt> elts;
 
 	size_t total_size;
@@ -75,10 +98,12 @@ public:
 	~Message();
 
 	bool is_sys_command();
+	inline bool is_multicast() { return dst==AGML_MULTICAST; }
 	void set_command(const std::string& cmd);
 	inline void set_command(int cmd_id) { src=dst=-1; channel = cmd_id; }
 
 	Message* copy();
+	void swap(Message& m);
 
 	inline void add(unsigned char* data, size_t size, bool bDisown = false) {
 		elts.push_back(MessageElt(data, size, bDisown));
@@ -92,6 +117,14 @@ public:
 	}
 
 
+	/** Removes the last element. Its data is the caller's to free if bDataAllocated */
+	inline MessageElt pop_back() {
+		MessageElt e = elts.back();
+		elts.pop_back();
+		total_size -= e.size;
+		return e;
+	}
+
 	template <typename T> void add(const T& t) { add((unsigned char*)&t, sizeof(T)); }
 	void add(const std::string& s) { add((unsigned char*)s.c_str(), s.length()+1, false); }
 	inline void add(const float* t, size_t nb, bool bDisown = false) { add((unsigned char*)t, sizeof(float)*nb, bDisown); }
@@ -102,10 +135,15 @@ public:
 
 	inline bool isEmpty() { return elts.empty(); }
 
-	void read(Socket* s);
+	void read(Socket* s, int version = AGML_WIRE_LEGACY);
 	void read(Host* h);
 
-	void write(Socket* s);
+	void write(Socket* s, int version = AGML_WIRE_LEGACY);
+	void write_compact(Socket* s, int version);
+
+	/** Compact format to/from memory (datagrams). pack() returns 0 if m doesn't fit in max bytes, unpack() false if buf is malformed */
+	size_t pack(unsigned char* buf, size_t max);
+	bool unpack(const unsigned char* buf, size_t len);
 
 	std::string dump();
 };
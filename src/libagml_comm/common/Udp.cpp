@@ -0,0 +1,401 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#include "Udp.h"
+#include "com.h"
+#include "Message.h"
+#include "Host.h"
+#include "../agml/node.h"
+#include "../simulation/Thread.h"
+#include "../topology/DataHost.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <sys/poll.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+
+/** Datagram header : type, then the sequence number being sent, acknowledged or refused */
+#define UDP_DATA 1
+#define UDP_ACK 2
+#define UDP_NACK 3
+#define UDP_HEADER (1+sizeof(uint64_t))
+
+/** Unanswered datagrams are sent again (with the same sequence number) this many times before we ask their fate over TCP */
+#define UDP_MAX_RETRIES 3
+/** Until the peer answers over TCP, we ask it again every this many ms */
+#define UDP_QUERY_PERIOD 1000
+
+/**
+ * Sequence numbers of a sender whose fate its receiver remembers : older ones are ignored.
+ * Senders keep their unsettled messages to a peer within half of it, so that the peer can always tell their fate
+ */
+#define UDP_WINDOW 4096
+
+/** After this many messages lost in a row, a peer is reached through TCP, but for a probe datagram every UDP_PROBE_PERIOD ms */
+#define UDP_MAX_LOST 8
+#define UDP_PROBE_PERIOD 1000
+
+/** A sent message waiting for its acknowledgement */
+struct UdpPending {
+	Message* m;
+	Node* src;
+	long t;
+	int nb_sent;
+	bool bQueried;		// asked over TCP, after UDP_MAX_RETRIES retries
+};
+
+/** Where a peer host listens for datagrams, the messages we sent it and how they fared */
+struct UdpPeer {
+	struct sockaddr_in addr;
+	DataHost* host;
+	/** Our sequence numbers to this peer only, so that its window spans our traffic to it alone */
+	uint64_t next_seq;
+	std::map<uint64_t, UdpPending> pending;
+	int nb_lost;
+	long t_probe;
+};
+
+/**
+ * What the receiver did with the last UDP_WINDOW sequence numbers of a sender, so that a datagram
+ * received again (resent, or duplicated by the network) gets the same answer and is never applied twice
+ */
+struct UdpWindow {
+	uint64_t top;
+	unsigned char state[UDP_WINDOW];
+};
+#define UDP_UNKNOWN 0
+#define UDP_APPLIED 1
+#define UDP_REFUSED 2
+
+static int udp_fd = -1;
+static unsigned short udp_port = 0;
+static pthread_t udp_thread;
+static volatile bool bUdpRunning = false;
+
+static pthread_mutex_t udp_mut = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, UdpPeer> udp_peers;
+
+/** Receiver windows by sender address, consulted by the UDP thread and by the TCP queries of our peers */
+static pthread_mutex_t udp_windows_mut = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::pair<uint32_t, uint16_t>, UdpWindow> udp_windows;
+
+
+/** @return the peer listening for to, NULL if it can't be resolved. Call with udp_mut unlocked */
+static UdpPeer* udp_get_peer(DataHost* to) {
+	const std::string& server_ip = to->server_ip;
+	pthread_mutex_lock(&udp_mut);
+	std::map<std::string, UdpPeer>::iterator i = udp_peers.find(server_ip);
+	UdpPeer* p = i!=udp_peers.end() ? &i->second : NULL;
+	pthread_mutex_unlock(&udp_mut);
+	if(p) return p;
+
+	std::string port = str_has(server_ip, ":") ? str_after(server_ip, ":") : TOSTRING(DEFAULT_PORT);
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	if(getaddrinfo(str_before(server_ip, ":").c_str(), port.c_str(), &hints, &res)) return NULL;
+
+	pthread_mutex_lock(&udp_mut);
+	p = &udp_peers[server_ip];
+	memcpy(&p->addr, res->ai_addr, sizeof(p->addr));
+	p->host = to;
+	// Above the sequence numbers this peer may remember from a previous run of ours
+	p->next_seq = (uint64_t)get_time_us() << 8;
+	p->nb_lost = 0;
+	p->t_probe = 0;
+	pthread_mutex_unlock(&udp_mut);
+	freeaddrinfo(res);
+	return p;
+}
+
+/** @return the peer whose datagrams come from addr, NULL if none. Call with udp_mut unlocked */
+static UdpPeer* udp_find_peer(const struct sockaddr_in& addr) {
+	UdpPeer* p = NULL;
+	pthread_mutex_lock(&udp_mut);
+	for(std::map<std::string, UdpPeer>::iterator i = udp_peers.begin(); i!=udp_peers.end() && !p; i++) {
+		if(i->second.addr.sin_addr.s_addr==addr.sin_addr.s_addr && i->second.addr.sin_port==addr.sin_port) p = &i->second;
+	}
+	pthread_mutex_unlock(&udp_mut);
+	return p;
+}
+
+
+bool udp_send(Node* src, DataHost* to, Message& m) {
+	if(udp_fd<0) return false;
+	unsigned char buf[AGML_UDP_MTU];
+	size_t n = m.pack(buf + UDP_HEADER, sizeof(buf) - UDP_HEADER);
+	UdpPeer* peer;
+	if(!n || !(peer = udp_get_peer(to))) return false;
+
+	long now = get_time_ms();
+	pthread_mutex_lock(&udp_mut);
+	// Peers which stopped acknowledging (no UDP, blocked port) don't keep our mass away for AGML_NET_UDP_TIMEOUT per message
+	if(peer->nb_lost >= UDP_MAX_LOST) {
+		if(now - peer->t_probe < UDP_PROBE_PERIOD) { pthread_mutex_unlock(&udp_mut); return false; }
+		peer->t_probe = now;
+	}
+	uint64_t seq = peer->next_seq;
+	// Too many unsettled messages : the peer might forget the oldest ones
+	if(!peer->pending.empty() && seq - peer->pending.begin()->first >= UDP_WINDOW/2) { pthread_mutex_unlock(&udp_mut); return false; }
+	peer->next_seq++;
+	UdpPending& p = peer->pending[seq];
+	p.m = m.copy(); p.src = src; p.t = now; p.nb_sent = 1; p.bQueried = false;
+	struct sockaddr_in addr = peer->addr;
+	pthread_mutex_unlock(&udp_mut);
+
+	buf[0] = UDP_DATA;
+	memcpy(buf+1, &seq, sizeof(seq));
+	if(sendto(udp_fd, buf, n + UDP_HEADER, 0, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		pthread_mutex_lock(&udp_mut);
+		std::map<uint64_t, UdpPending>::iterator i = peer->pending.find(seq);
+		if(i!=peer->pending.end()) { delete i->second.m; peer->pending.erase(i); }
+		pthread_mutex_unlock(&udp_mut);
+		return false;
+	}
+	return true;
+}
+
+
+///////////////
+// RECEPTION //
+///////////////
+
+/** @return the slot of seq in w (sliding w forward if needed), NULL if seq is too old to tell */
+static unsigned char* udp_window_slot(UdpWindow& w, uint64_t seq) {
+	if(seq > w.top) {
+		if(seq - w.top >= UDP_WINDOW) memset(w.state, UDP_UNKNOWN, sizeof(w.state));
+		else for(uint64_t s = w.top+1; s<=seq; s++) w.state[s % UDP_WINDOW] = UDP_UNKNOWN;
+		w.top = seq;
+	}
+	else if(w.top - seq >= UDP_WINDOW) return NULL;
+	return &w.state[seq % UDP_WINDOW];
+}
+
+/** @return the slot of seq in the window of the sender at (address, port), NULL if too old. Call with udp_windows_mut locked */
+static unsigned char* udp_get_slot(uint32_t address, uint16_t port, uint64_t seq) {
+	std::pair<uint32_t, uint16_t> key(address, port);
+	std::map<std::pair<uint32_t, uint16_t>, UdpWindow>::iterator i = udp_windows.find(key);
+	if(i==udp_windows.end()) {
+		UdpWindow& w = udp_windows[key];
+		w.top = seq;
+		memset(w.state, UDP_UNKNOWN, sizeof(w.state));
+		i = udp_windows.find(key);
+	}
+	return udp_window_slot(i->second, seq);
+}
+
+static void udp_on_data(unsigned char* buf, size_t n, struct sockaddr_in& from) {
+	uint64_t seq;
+	memcpy(&seq, buf+1, sizeof(seq));
+	pthread_mutex_lock(&udp_windows_mut);
+	unsigned char* state = udp_get_slot(from.sin_addr.s_addr, from.sin_port, seq);
+	if(!state) { pthread_mutex_unlock(&udp_windows_mut); return; } // Too old to know if we applied it : its sender asks over TCP
+
+	if(*state==UDP_UNKNOWN) {
+		Message* m = new Message();
+		if(!m->unpack(buf + UDP_HEADER, n - UDP_HEADER)) { delete m; pthread_mutex_unlock(&udp_windows_mut); return; }
+		Node* dst = NULL;
+		try { dst = com_decode_local_node(m->dst); } catch(std::exception& e) {}
+		// Refused (no such node, full mailbox) : the sender takes it back as dropped
+		if(dst && dst->thread->push_message(m, dst)) *state = UDP_APPLIED;
+		else { delete m; *state = UDP_REFUSED; }
+	}
+	buf[0] = *state==UDP_APPLIED ? UDP_ACK : UDP_NACK;
+	pthread_mutex_unlock(&udp_windows_mut);
+	sendto(udp_fd, buf, UDP_HEADER, 0, (struct sockaddr*)&from, sizeof(from));
+}
+
+/** Hands m back to its sender's thread, which src will get through on_dropped() */
+static void udp_hand_back(Message* m, Node* src) {
+	m->dst = m->src;
+	m->src = AGML_DROPPED;
+	if(!src->thread->push_message(m, src)) delete m;
+}
+
+/**
+ * The fate of seq is settled : an applied message is forgotten, a refused one (which the receiver will never apply)
+ * has its mass go back to the sender. bDatagram if the answer came through UDP, which then works with this peer.
+ */
+static void udp_settle(UdpPeer* peer, uint64_t seq, bool bApplied, bool bDatagram) {
+	pthread_mutex_lock(&udp_mut);
+	std::map<uint64_t, UdpPending>::iterator i = peer->pending.find(seq);
+	if(i==peer->pending.end()) { pthread_mutex_unlock(&udp_mut); return; }
+	UdpPending p = i->second;
+	if(bDatagram) peer->nb_lost = 0;
+	peer->pending.erase(i);
+	pthread_mutex_unlock(&udp_mut);
+	if(bApplied) delete p.m;
+	else udp_hand_back(p.m, p.src);
+}
+
+/** Asks peer over TCP what it did with seq. A peer we are disconnected from will never apply it : it is handed back */
+static void udp_query(UdpPeer* peer, uint64_t seq) {
+	Host* h = peer->host->host;
+	if(h) {
+		try { h->send_sys_command("udp_query", TOSTRING(udp_port << " " << seq)); return; }
+		catch(std::exception& e) {}
+	}
+	udp_settle(peer, seq, false, false);
+}
+
+/**
+ * Sends again the messages not answered within AGML_NET_UDP_TIMEOUT ms. A message still unanswered after
+ * UDP_MAX_RETRIES retries may have been applied (only its acknowledgements got lost) : we ask the peer over TCP,
+ * every UDP_QUERY_PERIOD ms until it answers.
+ */
+static void udp_check_timeouts() {
+	std::vector<std::pair<std::vector<unsigned char>, struct sockaddr_in> > resend;
+	std::vector<std::pair<UdpPeer*, uint64_t> > queries;
+	long now = get_time_ms();
+	pthread_mutex_lock(&udp_mut);
+	for(std::map<std::string, UdpPeer>::iterator p = udp_peers.begin(); p!=udp_peers.end(); p++) {
+		UdpPeer* peer = &p->second;
+		for(std::map<uint64_t, UdpPending>::iterator i = peer->pending.begin(); i!=peer->pending.end(); i++) {
+			if(now - i->second.t < (i->second.bQueried ? UDP_QUERY_PERIOD : AGML_NET_UDP_TIMEOUT)) continue;
+			i->second.t = now;
+			if(i->second.nb_sent <= UDP_MAX_RETRIES) {
+				i->second.nb_sent++;
+				resend.push_back(std::make_pair(std::vector<unsigned char>(AGML_UDP_MTU), peer->addr));
+				unsigned char* buf = &resend.back().first[0];
+				buf[0] = UDP_DATA;
+				memcpy(buf+1, &i->first, sizeof(uint64_t));
+				resend.back().first.resize(UDP_HEADER + i->second.m->pack(buf + UDP_HEADER, AGML_UDP_MTU - UDP_HEADER));
+				continue;
+			}
+			if(!i->second.bQueried) peer->nb_lost++;
+			i->second.bQueried = true;
+			queries.push_back(std::make_pair(peer, i->first));
+		}
+	}
+	pthread_mutex_unlock(&udp_mut);
+
+	for(size_t i=0; i<resend.size(); i++) {
+		sendto(udp_fd, &resend[i].first[0], resend[i].first.size(), 0, (struct sockaddr*)&resend[i].second, sizeof(resend[i].second));
+	}
+	for(size_t i=0; i<queries.size(); i++) udp_query(queries[i].first, queries[i].second);
+}
+
+void udp_on_query(Host* h, unsigned short port, uint64_t seq) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	if(!h->socket || getpeername(h->socket->socket, (struct sockaddr*)&addr, &len)) return;
+	pthread_mutex_lock(&udp_windows_mut);
+	unsigned char* state = udp_get_slot(addr.sin_addr.s_addr, htons(port), seq);
+	// Never received : refused for good, should it still arrive
+	if(state && *state==UDP_UNKNOWN) *state = UDP_REFUSED;
+	// Too old to tell (the sender keeps its messages within our window, though) : it may have been applied
+	bool bApplied = !state || *state==UDP_APPLIED;
+	pthread_mutex_unlock(&udp_windows_mut);
+	h->send_sys_command("udp_answer", TOSTRING(seq << " " << (bApplied ? 1 : 0)));
+}
+
+void udp_on_answer(Host* h, uint64_t seq, bool bApplied) {
+	if(!h->peer) return;
+	pthread_mutex_lock(&udp_mut);
+	std::map<std::string, UdpPeer>::iterator i = udp_peers.find(h->peer->server_ip);
+	UdpPeer* peer = i!=udp_peers.end() ? &i->second : NULL;
+	pthread_mutex_unlock(&udp_mut);
+	if(peer) udp_settle(peer, seq, bApplied, false);
+}
+
+static void* udp_thread_run(void*) {
+	unsigned char buf[65536];
+	while(bUdpRunning) {
+		struct pollfd pfd;
+		pfd.fd = udp_fd; pfd.events = POLLIN;
+		if(poll(&pfd, 1, 10) > 0) {
+			ssize_t n;
+			struct sockaddr_in from;
+			socklen_t len = sizeof(from);
+			while((n = recvfrom(udp_fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr*)&from, &len)) >= (ssize_t)UDP_HEADER) {
+				if(buf[0]==UDP_DATA) udp_on_data(buf, n, from);
+				else if(buf[0]==UDP_ACK || buf[0]==UDP_NACK) {
+					uint64_t seq;
+					memcpy(&seq, buf+1, sizeof(seq));
+					// Answers from an address we don't know get settled over TCP
+					UdpPeer* peer = udp_find_peer(from);
+					if(peer) udp_settle(peer, seq, buf[0]==UDP_ACK, true);
+				}
+				len = sizeof(from);
+			}
+		}
+		udp_check_timeouts();
+	}
+	return NULL;
+}
+
+
+///////////////
+// LIFECYCLE //
+///////////////
+
+void udp_start(unsigned short port) {
+	if(bUdpRunning) return;
+	udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if(udp_fd<0 || bind(udp_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		DBG("Couldn't listen to UDP port " << port << " : loss-tolerant channels will use TCP");
+		if(udp_fd>=0) close(udp_fd);
+		udp_fd = -1;
+		return;
+	}
+	udp_port = port;
+	bUdpRunning = true;
+	pthread_create(&udp_thread, NULL, udp_thread_run, NULL);
+}
+
+void udp_stop() {
+	if(!bUdpRunning) return;
+	bUdpRunning = false;
+	pthread_join(udp_thread, NULL);
+	close(udp_fd);
+	udp_fd = -1;
+	pthread_mutex_lock(&udp_mut);
+	for(std::map<std::string, UdpPeer>::iterator p = udp_peers.begin(); p!=udp_peers.end(); p++) {
+		for(std::map<uint64_t, UdpPending>::iterator i = p->second.pending.begin(); i!=p->second.pending.end(); i++) delete i->second.m;
+		p->second.pending.clear();
+	}
+	pthread_mutex_unlock(&udp_mut);
+}
@@ -0,0 +1,71 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#ifndef AGML_UDP_H_
+#define AGML_UDP_H_
+
+#include <string>
+#include <stdint.h>
+
+class Node;
+class Message;
+class DataHost;
+class Host;
+
+/** Largest datagram we send : bigger loss-tolerant messages go through TCP */
+#define AGML_UDP_MTU 1400
+
+
+/**
+ * Best-effort transport for the loss-tolerant channels of NodeGroups with the "udp" property.
+ * Each message is one datagram, acknowledged by the receiving host once queued for its Node, or refused
+ * (no such Node, full mailbox) : refused messages are handed back to their sender (see Node::on_dropped).
+ * Messages not answered within AGML_NET_UDP_TIMEOUT ms are sent again, and the receiver answers each sequence number
+ * the same way every time, applying it at most once. The fate of messages still unanswered is asked over TCP : the receiver
+ * refuses for good those it never got. Those to a host we got disconnected from are handed back.
+ */
+
+/** Listens for datagrams on the given port (the server's TCP port) */
+void udp_start(unsigned short port);
+void udp_stop();
+
+/** @return false if m can't travel as a datagram (too large, no UDP socket) : then send it through TCP */
+bool udp_send(Node* src, DataHost* to, Message& m);
+
+/** The peer behind h, sending datagrams from the given port, asks what we did with seq : answers through h */
+void udp_on_query(Host* h, unsigned short port, uint64_t seq);
+/** The peer behind h answers our query about seq */
+void udp_on_answer(Host* h, uint64_t seq, bool bApplied);
+
+
+#endif /* AGML_UDP_H_ */
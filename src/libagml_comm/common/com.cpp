@@ -34,6 +34,7 @@ knowledge of the CeCILL license and that you accept its terms.
 
 #include "com.h"
 #include "../tcp/Socket.h"
+#include "../tcp/Uring.h"
 #include "Host.h"
 #include "../util/array.h"
 #include "../agml/node.h"
@@ -41,6 +42,8 @@ knowledge of the CeCILL license and that you accept its terms.
 #include "../server/Server.h"
 #include "Commands.h"
 #include "../topology/Topology.h"
+#include <set>
+#include <sys/socket.h>
 
 
 ///////////////////
@@ -60,6 +63,14 @@ array<Host*> masters;
 
 array<Thread*> threads;
 long NB_NODES = 0;
+long AGML_NET_CREDITS = 256;
+long AGML_NET_FRAGMENT = 256*1024;
+long AGML_NET_MAX_MESSAGE = 1024*1024*1024;
+bool AGML_NET_URING = false;
+long AGML_NET_UDP_TIMEOUT = 100;
+long AGML_NET_FANOUT = 4;
+long AGML_STATS_CAPACITY = 256*1024;
+long AGML_TRACE_EVENTS = 64*1024;
 
 
 
@@ -71,6 +82,17 @@ long NB_NODES = 0;
 void com_init() {
 	SERVER_IP = get_my_first_ip();
 	DBG("My IP is " << SERVER_IP);
+	if(getenv("AGML_NET_CREDITS")) AGML_NET_CREDITS = MAX(2, atol(getenv("AGML_NET_CREDITS")));
+	if(getenv("AGML_NET_FRAGMENT")) AGML_NET_FRAGMENT = MAX(1024, atol(getenv("AGML_NET_FRAGMENT")));
+	if(getenv("AGML_NET_MAX_MESSAGE")) AGML_NET_MAX_MESSAGE = MAX(1024, atol(getenv("AGML_NET_MAX_MESSAGE")));
+	if(getenv("AGML_NET_UDP_TIMEOUT")) AGML_NET_UDP_TIMEOUT = MAX(1, atol(getenv("AGML_NET_UDP_TIMEOUT")));
+	if(getenv("AGML_NET_FANOUT")) AGML_NET_FANOUT = MAX(1, atol(getenv("AGML_NET_FANOUT")));
+	if(getenv("AGML_STATS_CAPACITY")) AGML_STATS_CAPACITY = MAX(1, atol(getenv("AGML_STATS_CAPACITY")));
+	if(getenv("AGML_TRACE_EVENTS")) AGML_TRACE_EVENTS = MAX(16, atol(getenv("AGML_TRACE_EVENTS")));
+	if(getenv("AGML_NET_IO") && !strcmp(getenv("AGML_NET_IO"), "uring")) {
+		AGML_NET_URING = uring_is_available();
+		if(!AGML_NET_URING) DBG("io_uring unavailable, falling back to blocking sockets");
+	}
 }
 
 void com_exit() {
@@ -114,6 +136,42 @@ Node* com_decode_local_node(long node_id) {
 	return g->get_local_node(id);
 }
 
+/** Messages received before we got the topology (peers may connect to us first) */
+static std::list<Message*> deferred;
+static bool bTopologyReady = false;
+static pthread_mutex_t deferred_mut = PTHREAD_MUTEX_INITIALIZER;
+
+void com_deliver(Message* m) {
+	pthread_mutex_lock(&deferred_mut);
+	if(!bTopologyReady) { deferred.push_back(m); pthread_mutex_unlock(&deferred_mut); return; }
+	pthread_mutex_unlock(&deferred_mut);
+
+	Node* n = NULL;
+	try { n = com_decode_local_node(m->dst); }
+	catch(std::exception& e) { ERROR("ERROR : Dropped message for node " << m->dst << " : " << e.what()); }
+	if(n) { n->thread->push_message(m, n); return; }
+	if(m->from) m->from->on_consumed();
+	delete m;
+}
+
+void com_on_topology_ready() {
+	std::list<Message*> l;
+	pthread_mutex_lock(&deferred_mut);
+	bTopologyReady = true;
+	l.swap(deferred);
+	pthread_mutex_unlock(&deferred_mut);
+	for(std::list<Message*>::iterator i = l.begin(); i!=l.end(); i++) com_deliver(*i);
+}
+
+static void com_forget_deferred(Host* h) {
+	pthread_mutex_lock(&deferred_mut);
+	for(std::list<Message*>::iterator i = deferred.begin(); i!=deferred.end();) {
+		if((*i)->from==h) { delete *i; i = deferred.erase(i); }
+		else i++;
+	}
+	pthread_mutex_unlock(&deferred_mut);
+}
+
 long com_encode_local_node(Node* n) {
 	return (((long)n->node_group->id) << 32) | n->id;
 }
@@ -147,6 +205,16 @@ struct _AGML_Command AGML_COMMANDS[] = {
 		{"infos", agml_command_infos, NULL},
 		{"infos_reply", agml_command_infos_reply, NULL},
 		{"node_request", agml_command_node_request, "string"},
+		{"credit", agml_command_credit, NULL},
+		{"data_stream", agml_command_data_stream, NULL},
+		{"wire_offer", agml_command_wire_offer, NULL},
+		{"wire_switch", agml_command_wire_switch, NULL},
+		{"join_subtree", agml_command_join_subtree, NULL},
+		{"host_ready", agml_command_host_ready, NULL},
+		{"trace", agml_command_trace, NULL},
+		{"do_trace", agml_command_do_trace, NULL},
+		{"udp_query", agml_command_udp_query, NULL},
+		{"udp_answer", agml_command_udp_answer, NULL},
 		{NULL,NULL,NULL}
 };
 
@@ -228,15 +296,114 @@ Host* com_enter_network(const std::string& bootstrap_ip) {
 	return h;
 }
 
-Host* com_add_to_network(const std::string& slave_ip) {
-	Host* h = new Host(new Socket(slave_ip.c_str(), true), true);
+/** Topology last spread to our slaves, for those joining late */
+static std::string slaves_topology;
+static pthread_mutex_t slaves_mut = PTHREAD_MUTEX_INITIALIZER;
+static volatile long nb_joining = 0;
+
+Host* com_add_to_network(const std::string& slave_ip, bool multiple_attempts) {
+	Socket* s = new Socket(slave_ip.c_str(), multiple_attempts);
+	pthread_mutex_lock(&slaves_mut);
+	Host* h = new Host(s, true);
 	slaves.add(h);
 
 	DBG("Invite " << h->server_ip << " to join the network");
-	h->send_sys_command("add_to_network");
+	try {
+		h->send_sys_command("add_to_network");
+		h->send_sys_command("root_welcome", TOSTRING(SERVER_PORT));
+		if(!slaves_topology.empty()) h->send_sys_command("set_topology", slaves_topology);
+	} catch(std::exception& e) { pthread_mutex_unlock(&slaves_mut); throw; }
+	pthread_mutex_unlock(&slaves_mut);
 	return h;
 }
 
+/** A slave to invite, with the slaves it will invite in turn */
+struct _com_invitation { std::string ip; std::vector<std::string> subtree; };
+
+static void* _com_add_to_network_thread(void* p) {
+	_com_invitation* inv = (_com_invitation*)p;
+	try {
+		Host* h = NULL;
+		if(!inv->subtree.empty()) {
+			// Don't hold its subtree back while retrying : we invite it ourselves
+			try { h = com_add_to_network(inv->ip, false); }
+			catch(std::exception& e) {
+				DBG(inv->ip << " unreachable, inviting the " << inv->subtree.size() << " hosts below it ourselves");
+				com_add_to_network(inv->subtree, 0);
+				inv->subtree.clear();
+			}
+		}
+		if(!h) h = com_add_to_network(inv->ip);
+		if(!inv->subtree.empty()) {
+			std::ostringstream oss;
+			for(size_t i=0; i<inv->subtree.size(); i++) oss << (i ? " " : "") << inv->subtree[i];
+			h->send_sys_command("join_subtree", oss.str());
+		}
+	} catch(std::exception& e) { ERROR("ERROR : " << e.what()); }
+	delete inv;
+	__sync_sub_and_fetch(&nb_joining, 1);
+	return NULL;
+}
+
+/**
+ * slave_ips are laid out as a k-ary heap below us : the children of the i-th one are at k*(i+1)..k*(i+1)+k-1.
+ * The subtree of a child, taken level by level, is laid out the same way below it.
+ */
+bool com_add_to_network(const std::vector<std::string>& slave_ips, long timeout_ms) {
+	size_t k = AGML_NET_FANOUT, n = slave_ips.size();
+	for(size_t c=1; c<=MIN(k,n); c++) {
+		_com_invitation* inv = new _com_invitation;
+		inv->ip = slave_ips[c-1];
+		std::list<size_t> level; level.push_back(c);
+		while(!level.empty()) {
+			size_t p = level.front(); level.pop_front();
+			for(size_t q=k*p+1; q<=k*p+k && q<=n; q++) { inv->subtree.push_back(slave_ips[q-1]); level.push_back(q); }
+		}
+
+		pthread_t th;
+		__sync_add_and_fetch(&nb_joining, 1);
+		if(pthread_create(&th, NULL, _com_add_to_network_thread, inv)) {
+			ERROR("ERROR : Couldn't invite " << inv->ip);
+			__sync_sub_and_fetch(&nb_joining, 1);
+			delete inv;
+		} else pthread_detach(th);
+	}
+	long t0 = get_time_ms();
+	while(nb_joining>0 && get_time_ms()-t0 < timeout_ms) usleep(10000);
+	return nb_joining==0;
+}
+
+void com_send_topology_slaves(const std::string& topology) {
+	pthread_mutex_lock(&slaves_mut);
+	slaves_topology = topology;
+	try { com_send_command_slaves("set_topology", topology); }
+	catch(std::exception& e) { pthread_mutex_unlock(&slaves_mut); throw; }
+	pthread_mutex_unlock(&slaves_mut);
+}
+
+
+/** Hosts the root waits for since the last model, and those which reported ready */
+static std::set<std::string> ready_hosts;
+static size_t nb_expected_hosts = 0;
+static long t_model = 0;
+
+void com_expect_hosts(size_t nb_hosts) {
+	pthread_mutex_lock(&slaves_mut);
+	ready_hosts.clear();
+	nb_expected_hosts = nb_hosts;
+	t_model = get_time_ms();
+	pthread_mutex_unlock(&slaves_mut);
+}
+
+void com_on_host_ready(const std::string& host) {
+	if(!AGML_IS_ROOT()) { com_send_command_masters("host_ready", host); return; }
+	pthread_mutex_lock(&slaves_mut);
+	if(nb_expected_hosts>0 && ready_hosts.insert(host).second) {
+		DBG("Host " << host << " ready (" << ready_hosts.size() << "/" << nb_expected_hosts << ")");
+		if(ready_hosts.size()==nb_expected_hosts) DBG("All " << nb_expected_hosts << " hosts ready in " << get_time_ms()-t_model << " ms");
+	}
+	pthread_mutex_unlock(&slaves_mut);
+}
 
 void com_root_on_subscribe(Host* subscriber) {
 	subscriber->send_sys_command("root_welcome", TOSTRING(SERVER_PORT));
@@ -252,6 +419,7 @@ void com_root_on_subscribe(Host* subscriber) {
 
 
 void com_connection_thread(Host* h) {
+	trace_thread_name(TOSTRING("connection " << h->server_ip));
 	hosts.add(h);
 	try {
 		while(h->is_connected()) {
@@ -272,6 +440,19 @@ void com_connection_thread(Host* h) {
 	if(h->data_host) ERROR("Data connection lost to " << h->data_host->host_name << " (ip=" << h->data_host->server_ip << ")");
 	else DBG("Client " << h->server_ip << " left");
 	hosts.remove(h);
+	// The extra streams of our peer go down with its main connection : they refer to its DataHost and credit their messages to h
+	if(h->peer && h->peer->host==h) {
+		h->peer->host = 0;
+		{
+			array<Host*>::snapshot s(h->peer->streams);
+			for(uint i=0; i<s.size(); i++) shutdown(s[i]->socket->socket, SHUT_RDWR);
+		}
+		while(!h->peer->streams.empty()) usleep(1000);
+		h->peer->reassembler.reset(h);
+	}
+	com_forget_deferred(h);
+	for(uint i=0; i<threads.size(); i++) threads[i]->forget_host(h);
+	if(h->peer) h->peer->streams.remove(h);
 	masters.remove(h);
 	slaves.remove(h);
 	if(h==root_host) root_host = 0;
@@ -64,6 +64,30 @@ extern array<Thread*> threads;
 
 extern long NB_NODES;
 
+/** Number of data messages a peer may send us before we grant it more (AGML_NET_CREDITS env. variable) */
+extern long AGML_NET_CREDITS;
+
+/** Messages larger than this many bytes are sent in interleavable fragments (AGML_NET_FRAGMENT env. variable) */
+extern long AGML_NET_FRAGMENT;
+
+/** Fragmented messages announcing more than this many bytes are refused, closing their connection (AGML_NET_MAX_MESSAGE env. variable) */
+extern long AGML_NET_MAX_MESSAGE;
+
+/** Connections use io_uring instead of blocking socket calls (AGML_NET_IO=uring env. variable, when the kernel supports it) */
+extern bool AGML_NET_URING;
+
+/** Loss-tolerant messages not acknowledged within this many ms are handed back to their sender (AGML_NET_UDP_TIMEOUT env. variable) */
+extern long AGML_NET_UDP_TIMEOUT;
+
+/** Hosts invite at most this many others when a model is spread, which invite the rest in turn (AGML_NET_FANOUT env. variable) */
+extern long AGML_NET_FANOUT;
+
+/** Number of node records in the shared memory stats region (AGML_STATS_CAPACITY env. variable) */
+extern long AGML_STATS_CAPACITY;
+
+/** Spans recorded per thread while tracing, the oldest being overwritten (AGML_TRACE_EVENTS env. variable) */
+extern long AGML_TRACE_EVENTS;
+
 
 ///////////////
 // Lifecycle //
@@ -101,6 +125,11 @@ long com_encode_local_node(Node* n);
 /** @return the Node object associated with id <i>node_id</i> */
 Node* com_decode_local_node(long node_id);
 
+/** Queues a received message for its local Node (once we have a topology : until then, messages wait) */
+void com_deliver(Message* m);
+/** Delivers the messages that arrived before the topology */
+void com_on_topology_ready();
+
 /** @return true if the given ip correspond to this machine */
 bool com_is_my_ip(const std::string& ip);
 
@@ -148,7 +177,22 @@ inline void com_send_command_root(const std::string& cmd_name, const std::string
 void com_model(const std::string& topology);
 
 Host* com_enter_network(const std::string& bootstrap_ip);
-Host* com_add_to_network(const std::string& slave_ip);
+/** Invites a slave to join our network (as its root). Slaves joining after the topology was spread receive it right away */
+Host* com_add_to_network(const std::string& slave_ip, bool multiple_attempts = true);
+/**
+ * Invites slaves through a tree, in parallel and in the background : we only invite the first AGML_NET_FANOUT ones,
+ * each one inviting its share of the others.
+ * @return false if some of those we invite are still joining after timeout_ms
+ */
+bool com_add_to_network(const std::vector<std::string>& slave_ips, long timeout_ms);
+
+/** Spreads the topology to our slaves, and to those that will join later */
+void com_send_topology_slaves(const std::string& topology);
+
+/** Starts timing how long nb_hosts hosts take to be ready (root only) */
+void com_expect_hosts(size_t nb_hosts);
+/** Notifies the root that the given host has read the topology */
+void com_on_host_ready(const std::string& host);
 
 void com_root_update_hosts();
 void com_root_on_subscribe(Host* subscriber);
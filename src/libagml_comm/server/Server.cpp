@@ -35,6 +35,7 @@ knowledge of the CeCILL license and that you accept its terms.
 #include "../tcp/Socket.h"
 #include "../tcp/Server.h"
 #include "../common/Host.h"
+#include "../common/Udp.h"
 
 Server* server = NULL;
 unsigned short SERVER_PORT = 10001;
@@ -49,6 +50,7 @@ void server_start(unsigned short _PORT) {
 	SERVER_PORT = _PORT;
 	server = new Server(SERVER_PORT, _connection_thread_server);
 	com_init();
+	udp_start(SERVER_PORT);
 	DBG("AGML Server Daemon started at " << str_date() << " on port " << SERVER_PORT);
 
 	shell("rm -f /run/shm/agml*");
@@ -60,6 +62,7 @@ void server_enter_network(const std::string& bootstrap_ip) {
 
 
 void server_stop() {
+	udp_stop();
 	if(server) {
 		server->close();
 		delete server;
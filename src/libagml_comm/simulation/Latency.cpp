@@ -0,0 +1,130 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#include "Latency.h"
+#include "Thread.h"
+#include <string.h>
+#include <iostream>
+#include <map>
+
+
+//////////////////////
+// LatencyHistogram //
+//////////////////////
+
+void LatencyHistogram::clear() {
+	memset(counts, 0, sizeof(counts));
+	nb = sum = max = 0;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& h) {
+	for(int i=0; i<LATENCY_NB_BUCKETS; i++) counts[i] += h.counts[i];
+	nb += h.nb;
+	sum += h.sum;
+	if(h.max > max) max = h.max;
+}
+
+uint64_t LatencyHistogram::bucket_max(int b) {
+	if(b < (1 << LATENCY_SUB_BITS)) return b;
+	int shift = (b >> LATENCY_SUB_BITS) - 1;
+	uint64_t sub = b & ((1 << LATENCY_SUB_BITS) - 1);
+	return (((1 << LATENCY_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::percentile(double q) const {
+	if(nb==0) return 0;
+	uint64_t rank = (uint64_t)(q*nb + 0.5);
+	if(rank < 1) rank = 1;
+	uint64_t n = 0;
+	for(int i=0; i<LATENCY_NB_BUCKETS; i++) {
+		n += counts[i];
+		if(n >= rank) return MIN(bucket_max(i), max);
+	}
+	return max;
+}
+
+
+
+////////////////////
+// LatencySummary //
+////////////////////
+
+LatencySummary::LatencySummary(int channel, int kind, const LatencyHistogram& h) : channel(channel), kind(kind) {
+	count = h.nb;
+	mean = h.nb ? (float)h.sum/h.nb : 0;
+	p50 = h.percentile(0.5);
+	p90 = h.percentile(0.9);
+	p99 = h.percentile(0.99);
+	p999 = h.percentile(0.999);
+	max = h.max;
+}
+
+static const char* LATENCY_KINDS[] = { "queue", "receive", "e2e", "process" };
+
+void LatencySummary::dump_JSON() {
+	std::cout << "{ ";
+	std::cout << "\"channel\" : " << channel << ", ";
+	std::cout << "\"kind\" : \"" << (kind>=0 && kind<LATENCY_NB_KINDS ? LATENCY_KINDS[kind] : "?") << "\", ";
+	std::cout << "\"count\" : " << count << ", ";
+	std::cout << "\"mean\" : " << mean << ", ";
+	std::cout << "\"p50\" : " << p50 << ", ";
+	std::cout << "\"p90\" : " << p90 << ", ";
+	std::cout << "\"p99\" : " << p99 << ", ";
+	std::cout << "\"p999\" : " << p999 << ", ";
+	std::cout << "\"max\" : " << max;
+	std::cout << " }";
+}
+
+
+
+/////////////
+
+void latency_summarize(int group, std::vector<LatencySummary>& out) {
+	std::map<int, LatencyEntry*> merged;
+	array<Thread*>::snapshot t(threads);
+	for(size_t i=0; i<t.size(); i++) {
+		array<LatencyEntry*>::snapshot l(t[i]->latency);
+		for(size_t j=0; j<l.size(); j++) {
+			if(l[j]->group!=group) continue;
+			LatencyEntry*& e = merged[l[j]->channel];
+			if(!e) e = new LatencyEntry(group, l[j]->channel);
+			for(int k=0; k<LATENCY_NB_KINDS; k++) e->h[k].merge(l[j]->h[k]);
+		}
+	}
+	for(std::map<int, LatencyEntry*>::iterator i = merged.begin(); i!=merged.end(); i++) {
+		for(int k=0; k<LATENCY_NB_KINDS; k++) {
+			if(i->second->h[k].nb) out.push_back(LatencySummary(i->first, k, i->second->h[k]));
+		}
+		delete i->second;
+	}
+}
@@ -0,0 +1,134 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#ifndef AGML_LATENCY_H_
+#define AGML_LATENCY_H_
+
+#include <stdint.h>
+#include <vector>
+
+/** What a histogram measures */
+enum {
+	LATENCY_QUEUE,		// time spent in the destination thread's mailbox
+	LATENCY_RECEIVE,	// on_receive() duration
+	LATENCY_E2E,		// from send() on the sender's host to the start of on_receive()
+	LATENCY_PROCESS,	// process() duration, sampled
+	LATENCY_NB_KINDS
+};
+
+/** Channel of the process() histograms */
+#define LATENCY_PROCESS_CHANNEL (-1)
+
+/** Only one process() call in 64 is timed */
+#define LATENCY_PROCESS_SAMPLING 63
+
+/**
+ * Only one message sent in 64 is timestamped (t_sent, wall clock) : its queueing and end-to-end latencies are recorded.
+ * on_receive() is timed for those, and for one in 64 of the others
+ */
+#define LATENCY_MESSAGE_SAMPLING 63
+
+/** Values (in µs) of 8 buckets per power of two, up to 2^40 µs */
+#define LATENCY_SUB_BITS 3
+#define LATENCY_NB_BUCKETS (38 << LATENCY_SUB_BITS)
+
+
+/**
+ * Log-linear histogram of durations in µs (HDR-style) : exact below 8 µs, then 8 buckets per power of two,
+ * i.e. percentiles within 12.5%. Written by a single thread, read (approximately) by anyone.
+ */
+class LatencyHistogram {
+public:
+	uint64_t counts[LATENCY_NB_BUCKETS];
+	uint64_t nb, sum, max;
+
+public:
+	LatencyHistogram() { clear(); }
+
+	void clear();
+
+	inline void record(long us) {
+		uint64_t v = us > 0 ? (uint64_t)us : 0;
+		counts[bucket(v)]++;
+		nb++;
+		sum += v;
+		if(v > max) max = v;
+	}
+
+	void merge(const LatencyHistogram& h);
+
+	/** @return an upper bound of the value below which a fraction q of the recorded values fall */
+	uint64_t percentile(double q) const;
+
+	static inline int bucket(uint64_t v) {
+		if(v < (1 << LATENCY_SUB_BITS)) return (int)v;
+		int e = 63 - __builtin_clzll(v);
+		if(e >= 40) return LATENCY_NB_BUCKETS - 1;
+		return ((e - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) + (int)((v >> (e - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1));
+	}
+
+	/** Largest value falling in bucket b */
+	static uint64_t bucket_max(int b);
+};
+
+
+/** Histograms of one channel of a node group, on one simulation thread */
+class LatencyEntry {
+public:
+	int group, channel;
+	LatencyHistogram h[LATENCY_NB_KINDS];
+
+	LatencyEntry(int group, int channel) : group(group), channel(channel) {}
+};
+
+
+/** Merged histogram, as sent with the infos */
+class LatencySummary {
+public:
+	int channel;
+	int kind;
+	uint64_t count;
+	float mean, p50, p90, p99, p999, max;
+
+	LatencySummary() { channel = kind = 0; count = 0; mean = p50 = p90 = p99 = p999 = max = 0; }
+	LatencySummary(int channel, int kind, const LatencyHistogram& h);
+
+	void dump_JSON();
+};
+
+
+/** Merges the histograms of all simulation threads for the local nodes of group g */
+void latency_summarize(int group, std::vector<LatencySummary>& out);
+
+
+#endif /* AGML_LATENCY_H_ */
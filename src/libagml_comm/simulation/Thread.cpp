@@ -35,19 +35,33 @@ knowledge of the CeCILL license and that you accept its terms.
 #include "../topology/Topology.h"
 #include <iomanip>
 #include <semaphore.h>
+#include <errno.h>
+#include <sched.h>
 
 static int _cur_id = 0;
 
 Thread::Thread() {
 	this->id = _cur_id++;
+	rng.seed(id);
 	this->thread = 0;
 	bStopped = true;
 	bHasThread = false;
 	nb_running_nodes = 0;
 	bRunning = false;
+	nb_inited = 0;
+	t_start = 0;
+	last_latency = 0;
+	nb_waiting_room = 0;
+	nb_sent = nb_received = 0;
+	consuming = 0;
+	now = get_coarse_time_ms();
+	sem_init(&sem, 0, 0);
 }
 
 Thread::~Thread() {
+	sem_destroy(&sem);
+	pthread_cond_destroy(&room);
+	for(std::map<std::pair<int,int>, LatencyEntry*>::iterator i = latency_index.begin(); i!=latency_index.end(); i++) delete i->second;
 }
 
 
@@ -93,10 +107,15 @@ void* _start_thread (void* p) { long r = ((Thread*)p)->run(); return (void*)r;}
 void Thread::start() {
 	if(!bStopped) {	ERROR("Thread " << id << " already started");	return;	}
 	bStopped = false;
+	t_start = get_time_ms();
 	if(!bHasThread) {pthread_create(&thread, NULL, _start_thread, this); bHasThread = true;}
 	sem_post(&sem);
 }
 
+void Thread::on_node_init() {
+	if(++nb_inited==nb_nodes()) DBG("Thread " << id << " : " << nb_inited << " nodes initialized in " << get_time_ms()-t_start << " ms");
+}
+
 void Thread::stop() {
 	if(bStopped) {	ERROR("Thread " << id << " already stopped");	return;	}
 	bStopped = true;
@@ -105,42 +124,51 @@ void Thread::stop() {
 
 /** Main execution loop  */
 int Thread::run() {
+	trace_thread_name(TOSTRING("simulation " << id));
 	bRunning = true;
 	long nbprocessed = 0;
-	long lasttime = get_time_ms();
+	long lasttime = get_coarse_time_ms();
 	while(bRunning) {
 		while(bStopped || (nb_nodes()==0 && fifo.empty())) sem_wait(&sem);
-
+		now = get_coarse_time_ms();
+		TRACE_SPAN("iteration");
 
 		// Pull any pending message
 		while(!fifo.empty()) {
-			Message* m = fifo.pop();
+			Message* m = pop_message();
 			on_receive(m);
+			if(m->from) m->from->on_consumed();
+			__sync_synchronize();
+			consuming = 0;
 			delete m;
 			m = 0;
 		}
 
 		if(nb_nodes() > 0) {
 			Node* n = draw_random_node();
-			if(n->bFinished) continue;
+			if(!n || n->bFinished) continue;
 
 			if(!n->bInited) {
 				n->bInited = true;
 				n->_init();
 			}
 			if(n->bAttached) {
-				n->_process();
+				if(nbprocessed & LATENCY_PROCESS_SAMPLING) n->_process();
+				else {
+					long t = get_monotonic_us();
+					n->_process();
+					get_latency(n->node_group->id, LATENCY_PROCESS_CHANNEL)->h[LATENCY_PROCESS].record(get_monotonic_us() - t);
+				}
 				nbprocessed++;
 			}
 		}
 
 
-		long time = get_time_ms();
-		if(time-lasttime>=1000) {
-			int n = nbprocessed*10000.0/(time-lasttime);
+		if(now-lasttime>=1000) {
+			int n = nbprocessed*10000.0/(now-lasttime);
 			DBG("Process " << std::fixed << std::setprecision(1) << n/10.0 << " nodes/s");
 			nbprocessed = 0;
-			lasttime = time;
+			lasttime = now;
 		}
 	}
 
@@ -159,7 +187,8 @@ int Thread::run() {
 
 
 Node* Thread::draw_random_node() {
-	return nodes[rand()%nodes.size()];
+	array<Node*>::snapshot s(nodes);
+	return s.empty() ? NULL : s[rng.uniform(s.size())];
 }
 
 
@@ -171,20 +200,147 @@ Node* Thread::draw_random_node() {
 ////////////////////
 
 void Thread::push_message(long src, long dst, int channel, const unsigned char* data, size_t size) {
-	push_message(new Message(src, dst, channel, data, size));
+	Message* m = new Message(src, dst, channel, data, size);
+	if(!push_message(m)) delete m;
+}
+
+static inline MailboxKey mailbox_key(Message* m, bool bConflate) {
+	return bConflate ? MailboxKey(m->dst, m->channel, m->src, m->from) : MailboxKey(m->dst, m->channel);
+}
+
+bool Thread::mailbox_is_full(Node* n, size_t size) {
+	NodeGroup* g = n->node_group;
+	return (g->mailbox_size && n->mailbox_nb >= g->mailbox_size) || (g->mailbox_bytes && n->mailbox_bytes + (long)size > g->mailbox_bytes && n->mailbox_nb > 0);
 }
 
-void Thread::push_message(Message* m) {
-	fifo.push(m);
+bool Thread::push_message(Message* m, Node* dst) {
+	if(!dst) {
+		try { dst = com_decode_local_node(m->dst); } catch(std::exception& e) {}
+	}
+	// Dropped messages coming back to their sender are neither merged nor refused
+	bool bDropped = m->src==AGML_DROPPED;
+	bool bConflate = dst && !bDropped && dst->node_group->bConflate;
+	MessageCombiner c = (dst && !bConflate && !bDropped) ? dst->get_combiner(m->channel) : 0;
+
+	fifo.LOCK();
+	if(bConflate || c) {
+		std::map<MailboxKey, Message*>::iterator i = pending.find(mailbox_key(m, bConflate));
+		if(i!=pending.end()) {
+			Message* into = i->second;
+			bool bMerged = false;
+			if(bConflate) {
+				// Superseded : the queued message takes the new content, the old one is dropped unread
+				dst->mailbox_bytes += (long)m->total_size - (long)into->total_size;
+				into->swap(*m);
+				bMerged = true;
+			} else {
+				into->begin(); m->begin();
+				bMerged = into->bDataAllocated && into->total_size==m->total_size && c(into, m);
+			}
+			if(bMerged) {
+				fifo.UNLOCK();
+				if(m->from) m->from->on_consumed();
+				delete m;
+				return true;
+			}
+		}
+	}
+	if(dst) {
+		if(!m->from && !bDropped && mailbox_is_full(dst, m->total_size)) { fifo.UNLOCK(); return false; }
+		if(m->t_sent) m->t_queued = get_monotonic_us();
+		dst->mailbox_nb++;
+		dst->mailbox_bytes += m->total_size;
+	}
+	if(bConflate || c) pending[mailbox_key(m, bConflate)] = m;
+	fifo.list.push_back(m);
+	fifo.UNLOCK();
 	sem_post(&sem);
+	return true;
+}
+
+bool Thread::wait_room(Node* dst, Message& m, long timeout) {
+	NodeGroup* g = dst->node_group;
+	if(!g->mailbox_size && !g->mailbox_bytes) return true;
+	if(g->bConflate || dst->get_combiner(m.channel)) return true; // May be merged : let push_message() decide
+	if(!mailbox_is_full(dst, m.total_size)) return true;
+	struct timespec deadline = get_deadline(timeout);
+	bool bRoom = true;
+	fifo.LOCK();
+	nb_waiting_room++;
+	while(mailbox_is_full(dst, m.total_size)) {
+		if(pthread_cond_timedwait(&room, &fifo.mut, &deadline)==ETIMEDOUT) { bRoom = !mailbox_is_full(dst, m.total_size); break; }
+	}
+	nb_waiting_room--;
+	fifo.UNLOCK();
+	return bRoom;
+}
+
+Message* Thread::pop_message() {
+	fifo.LOCK();
+	Message* m = fifo.list.front();
+	fifo.list.pop_front();
+	Node* n = 0;
+	try { n = com_decode_local_node(m->dst); } catch(std::exception& e) {}
+	if(n) {
+		n->mailbox_nb--;
+		n->mailbox_bytes -= m->total_size;
+		if(nb_waiting_room) pthread_cond_broadcast(&room);
+	}
+	if(!pending.empty()) {
+		for(int conflate=0; conflate<2; conflate++) {
+			std::map<MailboxKey, Message*>::iterator i = pending.find(mailbox_key(m, conflate));
+			if(i!=pending.end() && i->second==m) { pending.erase(i); break; }
+		}
+	}
+	consuming = m->from;
+	fifo.UNLOCK();
+	return m;
+}
+
+void Thread::forget_host(Host* h) {
+	fifo.LOCK();
+	for(std::list<Message*>::iterator i = fifo.list.begin(); i!=fifo.list.end(); i++) {
+		if((*i)->from==h) (*i)->from = 0;
+	}
+	// Conflation keys hold the source host too : rekey its messages as pop_message() will look them up
+	for(std::map<MailboxKey, Message*>::iterator i = pending.begin(); i!=pending.end();) {
+		if(i->first.from!=h) { i++; continue; }
+		MailboxKey k = i->first;
+		k.from = 0;
+		Message* m = i->second;
+		pending.erase(i++);
+		pending.insert(std::make_pair(k, m));
+	}
+	fifo.UNLOCK();
+	while(consuming==h) sched_yield();
 }
 
 void Thread::on_receive(Message* m) {
 	Node* n = com_decode_local_node(m->dst);
 	if(!n) { ERROR("ERROR : Node overflow in thread " << id << " for node " << m->dst); throw std::runtime_error("node overflow"); }
+	if(!m->t_sent && (nb_received++ & LATENCY_MESSAGE_SAMPLING)) {
+		try {
+			n->_receive(m);
+		} catch(std::exception& e) { ERROR("ERROR while receiving at node " << n->dump() << " : " << e.what()); }
+		return;
+	}
+	LatencyEntry* l = get_latency(n->node_group->id, m->channel);
+	long t = get_monotonic_us();
+	if(m->t_queued) l->h[LATENCY_QUEUE].record(t - m->t_queued);
+	if(m->t_sent) l->h[LATENCY_E2E].record(get_time_us() - m->t_sent);
 	try {
 		n->_receive(m);
 	} catch(std::exception& e) { ERROR("ERROR while receiving at node " << n->dump() << " : " << e.what()); }
+	l->h[LATENCY_RECEIVE].record(get_monotonic_us() - t);
+}
+
+LatencyEntry* Thread::add_latency(int group, int channel) {
+	LatencyEntry*& e = latency_index[std::make_pair(group, channel)];
+	if(!e) {
+		e = new LatencyEntry(group, channel);
+		latency.add(e);
+	}
+	return e;
 }
 
 
@@ -208,9 +364,10 @@ void agml_thread_end(Thread* th) {
 int threads_get_lightest() {
 	int th = 0;
 	long th_load = -1;
-	for(uint i=0; i<threads.size(); i++) {
-		if(threads[i]->nb_nodes() < th_load || th_load == -1) {
-			th = i; th_load = threads[i]->nb_nodes();
+	array<Thread*>::snapshot t(threads);
+	for(uint i=0; i<t.size(); i++) {
+		if(t[i]->nb_nodes() < th_load || th_load == -1) {
+			th = i; th_load = t[i]->nb_nodes();
 		}
 	}
 	return th;
@@ -38,13 +38,31 @@ knowledge of the CeCILL license and that you accept its terms.
 #include "../util/fifo.h"
 #include "../common/com.h"
 #include "../util/array.h"
+#include "../util/rng.h"
 #include <pthread.h>
 #include "../common/Host.h"
 #include "../agml/node.h"
+#include "Latency.h"
 #include <semaphore.h>
+#include <map>
 
 class Node;
 
+/** Identifies the pending message a new one may be combined into or replace */
+class MailboxKey {
+public:
+	long dst, src;
+	int channel;
+	Host* from;
+	MailboxKey(long dst, int channel, long src = 0, Host* from = 0) : dst(dst), src(src), channel(channel), from(from) {}
+	inline bool operator<(const MailboxKey& k) const {
+		if(dst!=k.dst) return dst<k.dst;
+		if(channel!=k.channel) return channel<k.channel;
+		if(src!=k.src) return src<k.src;
+		return from<k.from;
+	}
+};
+
 class Thread {
 public:
 	int id;
@@ -53,6 +71,28 @@ public:
 
 	FIFO<Message*> fifo;
 
+	/** Queued messages that later ones may be combined into (by dst and channel) or replace (by dst, channel and source) */
+	std::map<MailboxKey, Message*> pending;
+
+	/** Signaled (under fifo's lock) when a message leaves the fifo while senders wait for room */
+	pthread_cond_t room = PTHREAD_COND_INITIALIZER;
+	int nb_waiting_room;
+
+	/** Host of the message being consumed, until its credit is returned */
+	Host* volatile consuming;
+
+	/** Scheduler random generator, only used by this thread */
+	Rng rng;
+
+	/** Coarse clock (see get_coarse_time_ms()), updated once per scheduling iteration */
+	long now;
+
+	/** Messages sent by and received by the nodes of this thread, to sample their latencies (see LATENCY_MESSAGE_SAMPLING) */
+	unsigned long nb_sent, nb_received;
+
+	/** Latency histograms of the nodes of this thread, by group and channel : written by this thread only */
+	array<LatencyEntry*> latency;
+
 	bool bStopped, bHasThread;
 	pthread_t thread;
 	pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
@@ -62,6 +102,14 @@ private:
 	bool bRunning;
 	uint nb_running_nodes;
 
+	/** Nodes whose init() ran (on this thread), and when the thread was started */
+	long nb_inited;
+	long t_start;
+
+	/** This thread's index into latency, and the last entry it hit */
+	std::map<std::pair<int,int>, LatencyEntry*> latency_index;
+	LatencyEntry* last_latency;
+
 public:
 	Thread();
 	virtual ~Thread();
@@ -94,6 +142,8 @@ public:
 	void attach(Node* node);
 	void detach(Node* node);
 	void on_node_finish();
+	/** Called by a node of this thread once its init() ran */
+	void on_node_init();
 
 
 	//////////////////////
@@ -110,10 +160,30 @@ public:
 	// COMMUNICATIONS //
 	////////////////////
 
-	void push_message(Message* m);
+	/**
+	 * Queue m for delivery, possibly combining it with or replacing a pending message.
+	 * @param dst : destination node (resolved from m->dst if not given)
+	 * @return false if dst's mailbox is full ; messages from remote hosts are bounded by credits instead
+	 */
+	bool push_message(Message* m, Node* dst = 0);
 	void push_message(long src, long dst, int channel, const unsigned char* data, size_t size);
+	Message* pop_message();
+	/** Clears h from the queued messages (they return no credit), and waits until h's message being consumed (if any) is done */
+	void forget_host(Host* h);
+
+	/** Wait up to timeout ms until dst's mailbox has room for m */
+	bool wait_room(Node* dst, Message& m, long timeout);
+	static bool mailbox_is_full(Node* dst, size_t size);
 	void on_receive(Message* m);
 
+	/** Histograms of group's channel on this thread, created on first use. Only called by this thread */
+	inline LatencyEntry* get_latency(int group, int channel) {
+		if(last_latency && last_latency->group==group && last_latency->channel==channel) return last_latency;
+		return last_latency = add_latency(group, channel);
+	}
+
+private:
+	LatencyEntry* add_latency(int group, int channel);
 };
 
 
@@ -32,6 +32,7 @@ knowledge of the CeCILL license and that you accept its terms.
 */
 
 #include "Socket.h"
+#include "../util/trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -46,11 +47,29 @@ knowledge of the CeCILL license and that you accept its terms.
 #include <fcntl.h>
 #include <netinet/tcp.h>
 #include <sys/poll.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include "../util/utils.h"
+#include "Uring.h"
 #include <stdexcept>
 #include <signal.h>
 #include <netdb.h>
 #include <ifaddrs.h>
+#include <errno.h>
+#include <pthread.h>
+#include <map>
+
+
+/** io_uring settings : ring depth, and the provided buffers multishot receives land in */
+#define URING_ENTRIES 32
+#define URING_NB_BUFFERS 16
+#define URING_BUFFER_SIZE (64*1024)
+#define URING_BGID 0
+
+/** Connection attempts time out after CONNECT_TIMEOUT ms, and are retried after exponentially growing delays */
+#define CONNECT_TIMEOUT 3000
+#define CONNECT_BACKOFF_MIN 100
+#define CONNECT_BACKOFF_MAX 5000
 
 
 ///////////
@@ -77,10 +96,61 @@ static void _init_() {
 	_bInited = true;
 }
 
+/** Resolved host names, so that connecting to many hosts queries the resolver once per name */
+static std::map<std::string, struct in_addr> dns_cache;
+static pthread_mutex_t dns_mut = PTHREAD_MUTEX_INITIALIZER;
+
+static bool dns_lookup(const std::string& hostname, struct in_addr& addr) {
+	pthread_mutex_lock(&dns_mut);
+	std::map<std::string, struct in_addr>::iterator i = dns_cache.find(hostname);
+	bool bFound = i!=dns_cache.end();
+	if(bFound) addr = i->second;
+	pthread_mutex_unlock(&dns_mut);
+	if(bFound) return true;
+
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo(hostname.c_str(), NULL, &hints, &res)) return false; // Failures aren't cached : the name may resolve later
+	addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr;
+	freeaddrinfo(res);
+
+	pthread_mutex_lock(&dns_mut);
+	dns_cache[hostname] = addr;
+	pthread_mutex_unlock(&dns_mut);
+	return true;
+}
 
-Socket::Socket(const char* ip, unsigned short int port) {
+/** Non-blocking connect(), so that unreachable hosts fail after timeout_ms instead of the system's SYN timeout */
+static bool connect_timeout(int s, struct sockaddr_in& addr, int timeout_ms) {
+	int flags = fcntl(s, F_GETFL, 0);
+	fcntl(s, F_SETFL, flags | O_NONBLOCK);
+	int r = ::connect(s, (struct sockaddr*)&addr, sizeof(addr));
+	if(r<0 && errno==EINPROGRESS) {
+		struct pollfd pfd;
+		pfd.fd = s; pfd.events = POLLOUT;
+		int err = 0;
+		socklen_t len = sizeof(err);
+		r = (poll(&pfd, 1, timeout_ms)==1 && !getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len) && !err) ? 0 : -1;
+	}
+	fcntl(s, F_SETFL, flags);
+	return r==0;
+}
+
+void Socket::init() {
 	if(!_bInited) _init_();
 	readBlocking = true; readTimeout = 0;
+	rdata = rbuf;
+	rpos = rlen = 0;
+	rx = tx = NULL;
+	rx_bid = -1;
+	rx_armed = false;
+}
+
+
+Socket::Socket(const char* ip, unsigned short int port) {
+	init();
 	bConnected = false;
 
 	strcpy(this->ip, ip);
@@ -91,8 +161,7 @@ Socket::Socket(const char* ip, unsigned short int port) {
 
 
 Socket::Socket(const char* url, bool multiple_attempts) {
-	if(!_bInited) _init_();
-	readBlocking = true; readTimeout = 0;
+	init();
 	bConnected = false;
 	bClient = true;
 	socket = 0;
@@ -118,31 +187,33 @@ void Socket::connect(int nb_attempts) {
 	if(!_bInited) _init_();
 	bClient = true;
 
-	// Create socket
-    socket = ::socket(AF_INET, SOCK_STREAM, 0);
-    if (socket < 0) throw("can't create socket");
-
-	int flag = 1;
-	setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int));
-
+	long delay = CONNECT_BACKOFF_MIN;
 	for(int attempt = 1; attempt<=nb_attempts; attempt++) {
 		try {
 			// Create address
-			struct hostent *server;
-			if (!(server = gethostbyname(this->ip))) throw std::runtime_error(TOSTRING("No such host : " << ip << ":" << port));
 			struct sockaddr_in serv_addr;
 			bzero((char *) &serv_addr, sizeof(serv_addr));
 			serv_addr.sin_family = AF_INET;
-			bcopy((char *)server->h_addr, (char *)&serv_addr.sin_addr.s_addr, server->h_length);
+			if(!dns_lookup(this->ip, serv_addr.sin_addr)) throw std::runtime_error(TOSTRING("No such host : " << ip << ":" << port));
 			serv_addr.sin_port = htons(port);
 
+			// Create socket (a fresh one per attempt : a failed connect() leaves it unusable)
+			socket = ::socket(AF_INET, SOCK_STREAM, 0);
+			if (socket < 0) throw std::runtime_error("can't create socket");
+			int flag = 1;
+			setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int));
+
 			// Connect socket to addr
-			if (::connect(socket,(struct sockaddr *) &serv_addr,sizeof(serv_addr)) < 0)
+			if (!connect_timeout(socket, serv_addr, CONNECT_TIMEOUT)) {
+				::close(socket);
 				throw std::runtime_error(TOSTRING("Connection to " << ip << ":" << port << " refused"));
+			}
 			break;
 		} catch(std::exception& e) {
 			if(attempt==nb_attempts) throw std::runtime_error(e.what());
-			else {DBG(e.what() << " (attempt " << attempt << ")"); sleep(1);}
+			DBG(e.what() << " (attempt " << attempt << ", retrying in " << delay << "ms)");
+			usleep(delay*1000);
+			delay = MIN(delay*2, CONNECT_BACKOFF_MAX);
 		}
 	}
 
@@ -150,8 +221,7 @@ void Socket::connect(int nb_attempts) {
 }
 
 Socket::Socket(int socket, struct sockaddr_in* addr, size_t len) {
-	if(!_bInited) _init_();
-	readBlocking = true; readTimeout = 0;
+	init();
 	int flag = 1;
 	setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int));
 	this->socket = socket;
@@ -165,10 +235,34 @@ Socket::Socket(int socket, struct sockaddr_in* addr, size_t len) {
 Socket::~Socket() {
 	shutdown(socket, SHUT_RDWR);
 	close(socket);
+#ifdef AGML_URING
+	if(tx) pthread_mutex_destroy(&tx_mut);
+	delete rx;
+	delete tx;
+#endif
+}
+
+bool Socket::enable_uring() {
+#ifdef AGML_URING
+	if(rx) return true;
+	Uring* r = new Uring();
+	Uring* t = new Uring();
+	if(!r->init(URING_ENTRIES) || !r->init_buffers(URING_NB_BUFFERS, URING_BUFFER_SIZE, URING_BGID) || !t->init(URING_ENTRIES)) {
+		delete r; delete t;
+		return false;
+	}
+	pthread_mutex_init(&tx_mut, NULL);
+	tx = t;
+	rx = r;
+	return true;
+#else
+	return false;
+#endif
 }
 
 
 void Socket::write(void* buffer, size_t size) {
+	if(tx) { struct iovec v; v.iov_base = buffer; v.iov_len = size; writev(&v, 1); return; }
     int n = ::write(socket,buffer,size);
     if (n < 0) throw SocketClosedException();
 
@@ -177,16 +271,73 @@ void Socket::write(void* buffer, size_t size) {
 #endif
 }
 
+void Socket::writev(struct iovec* iov, int n) {
+#ifdef AGML_URING
+	if(tx) pthread_mutex_lock(&tx_mut);
+#endif
+	while(n>0) {
+		ssize_t w;
+#ifdef AGML_URING
+		// Without a free SQE, this write falls back to a blocking writev()
+		struct io_uring_sqe* sqe = tx ? tx->get_sqe() : NULL;
+		if(sqe) {
+			// One SENDMSG submission per gathered write, completion reaped in the same io_uring_enter()
+			struct msghdr mh;
+			memset(&mh, 0, sizeof(mh));
+			mh.msg_iov = iov; mh.msg_iovlen = MIN(n, IOV_MAX);
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = socket;
+			sqe->addr = (unsigned long)&mh;
+			sqe->len = 1;
+			sqe->msg_flags = MSG_NOSIGNAL;
+			struct io_uring_cqe* cqe = tx->submit(1) < 0 ? NULL : tx->next_cqe();
+			w = cqe ? cqe->res : -1;
+			if(cqe) tx->cqe_seen();
+			if(w < 0) { pthread_mutex_unlock(&tx_mut); throw SocketClosedException(); }
+		} else
+#endif
+		w = ::writev(socket, iov, MIN(n, IOV_MAX));
+		if(w < 0) {
+#ifdef AGML_URING
+			if(tx) pthread_mutex_unlock(&tx_mut);
+#endif
+			throw SocketClosedException();
+		}
+		// Skip what has been written, resume within a partially written buffer
+		while(n>0 && (size_t)w >= iov->iov_len) { w -= iov->iov_len; iov++; n--; }
+		if(n>0) { iov->iov_base = (char*)iov->iov_base + w; iov->iov_len -= w; }
+	}
+#ifdef AGML_URING
+	if(tx) pthread_mutex_unlock(&tx_mut);
+#endif
+}
+
 
 bool Socket::waitForMsg(int timeout_ms) {
+	if(rpos<rlen) return true;
 	struct pollfd pfd;
 	pfd.fd = socket; pfd.events = POLLIN;
+#ifdef AGML_URING
+	// The multishot receive consumes socket readiness : wait for its completions instead
+	if(rx) {
+		arm();
+		if(rx->next_cqe(false)) return true;
+		pfd.fd = rx->get_fd();
+	}
+#endif
 	poll(&pfd, 1, timeout_ms);
 	return pfd.revents & POLLIN;
 }
 
 size_t Socket::read(void* buffer, size_t maxSize) {
 	int n;
+	if(rx && rpos>=rlen) fill();
+	if(rpos<rlen) {
+		n = MIN(maxSize, rlen-rpos);
+		memcpy(buffer, rdata+rpos, n);
+		rpos += n;
+		return n;
+	}
 	if(!readBlocking && readTimeout>0) if(!waitForMsg(this->readTimeout)) throw "Timeout exceeded";
 	n = ::recv(socket,buffer,maxSize, readBlocking ? 0 : MSG_DONTWAIT);
 	if (n < 0) throw std::runtime_error("ERROR reading from socket");
@@ -202,13 +353,21 @@ size_t Socket::read_exactly(void* buffer, size_t maxSize) {
 	char* buf = (char*)buffer;
 	size_t ntot = 0;
 	while(ntot < maxSize) {
+		if(rpos<rlen) {
+			size_t n = MIN(maxSize-ntot, rlen-rpos);
+			memcpy(buf, rdata+rpos, n);
+			rpos += n; ntot += n; buf += n;
+			continue;
+		}
+		// Large reads go straight to the destination, small ones through the buffer
+		if(rx || maxSize-ntot < sizeof(rbuf)) { fill(); continue; }
 		int n;
 		if(!readBlocking && readTimeout>0) if(!waitForMsg(this->readTimeout)) throw std::runtime_error("Timeout exceeded");
-		n = ::recv(socket,buf,maxSize-ntot, readBlocking ? 0 : MSG_DONTWAIT);
+		TRACE_SPAN("recv");
+		n = ::recv(socket, buf, maxSize-ntot, readBlocking ? 0 : MSG_DONTWAIT);
 		if (n < 0) throw std::runtime_error("ERROR reading from socket");
 		if (n == 0) throw SocketClosedException();
-		ntot+=n;
-		buf+=n;
+		ntot+=n; buf+=n;
 	}
 
 #ifdef SOCKET_DEBUG
@@ -217,6 +376,52 @@ size_t Socket::read_exactly(void* buffer, size_t maxSize) {
     return ntot;
 }
 
+void Socket::arm() {
+#ifdef AGML_URING
+	if(rx_armed) return;
+	struct io_uring_sqe* sqe = rx->get_sqe();
+	if(!sqe) throw std::runtime_error("ERROR reading from socket : io_uring submission queue full");
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = socket;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	if(rx->submit() < 0) throw std::runtime_error("ERROR reading from socket");
+	rx_armed = true;
+#endif
+}
+
+void Socket::fill() {
+	TRACE_SPAN("recv");
+	if(!readBlocking && readTimeout>0) if(!waitForMsg(this->readTimeout)) throw std::runtime_error("Timeout exceeded");
+#ifdef AGML_URING
+	if(rx) {
+		if(rx_bid>=0) { rx->recycle(rx_bid); rx_bid = -1; }
+		for(;;) {
+			arm();
+			struct io_uring_cqe* cqe = rx->next_cqe(readBlocking);
+			if(!cqe) throw std::runtime_error("ERROR reading from socket");
+			int res = cqe->res;
+			unsigned flags = cqe->flags;
+			rx->cqe_seen();
+			if(!(flags & IORING_CQE_F_MORE)) rx_armed = false;
+			if(res == -ENOBUFS) continue; // We hold no buffer at this point, so this only ends the multishot : re-arm it
+			if(res < 0) throw std::runtime_error("ERROR reading from socket");
+			if(res == 0) throw SocketClosedException();
+			rx_bid = flags >> IORING_CQE_BUFFER_SHIFT;
+			rdata = rx->buffer(rx_bid);
+			rpos = 0; rlen = res;
+			return;
+		}
+	}
+#endif
+	int n = ::recv(socket, rbuf, sizeof(rbuf), readBlocking ? 0 : MSG_DONTWAIT);
+	if (n < 0) throw std::runtime_error("ERROR reading from socket");
+	if (n == 0) throw SocketClosedException();
+	rdata = rbuf;
+	rpos = 0; rlen = n;
+}
+
 void Socket::writeFile(const char* filename) {
 	struct stat stat_buf;
 	int f = open(filename, O_RDONLY);
@@ -254,31 +459,10 @@ bool Socket::readAck() {
 
 
 std::string resolve_ip(const std::string& hostname) {
-	std::string ip = hostname;
-    struct addrinfo hints, *servinfo, *p;
-    struct sockaddr_in *h;
-    int rv;
-
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC; // use AF_INET6 to force IPv6
-    hints.ai_socktype = SOCK_STREAM;
-
-    if ( (rv = getaddrinfo( hostname.c_str() , "http" , &hints , &servinfo)) != 0)
-    {
-//        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
-        return ip;
-    }
-
-    // loop through all the results and connect to the first we can
-    for(p = servinfo; p != NULL; p = p->ai_next)
-    {
-        h = (struct sockaddr_in *) p->ai_addr;
-        ip = inet_ntoa( h->sin_addr );
-    }
-
-    freeaddrinfo(servinfo); // all done with this structure
-
-    return ip;
+	struct in_addr addr;
+	char ip[INET_ADDRSTRLEN];
+	if(!dns_lookup(hostname, addr) || !inet_ntop(AF_INET, &addr, ip, sizeof(ip))) return hostname;
+	return ip;
 }
 
 /** @return the first valid IP address of this machine's network interfaces */
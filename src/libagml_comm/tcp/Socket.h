@@ -40,6 +40,8 @@ knowledge of the CeCILL license and that you accept its terms.
 #include <exception>
 #include <string>
 #include <stdexcept>
+#include <sys/uio.h>
+#include <pthread.h>
 
 #define DEFAULT_PORT 10001
 //#define SOCKET_DEBUG // Uncomment for socket messages debug
@@ -48,6 +50,8 @@ knowledge of the CeCILL license and that you accept its terms.
 #define SOCKET_WRITE_STRING_DELAY 10000
 
 
+class Uring;
+
 class SocketClosedException : public std::runtime_error {
 public:
 	SocketClosedException() : std::runtime_error("SocketClosedException") {}
@@ -62,6 +66,17 @@ private:
 	bool readBlocking;
 	int readTimeout;
 	bool bClient;
+	/** Small reads are served from this buffer, refilled a recv() at a time */
+	unsigned char rbuf[4096];
+	/** Data being consumed : rbuf, or an io_uring provided buffer */
+	unsigned char* rdata;
+	size_t rpos, rlen;
+	/** io_uring rings (NULL for plain blocking sockets) : multishot receives for the reader, sends under tx_mut */
+	Uring* rx;
+	Uring* tx;
+	int rx_bid;
+	bool rx_armed;
+	pthread_mutex_t tx_mut;
 public:
 	char ip[256];
 	unsigned short int port;
@@ -74,6 +89,10 @@ public:
 	void setReadBlocking(bool rb) {this->readBlocking = rb;}
 	void setReadTimeout(size_t timeout) {setReadBlocking(false); readTimeout = timeout;}
 
+	/** Switches this socket to io_uring I/O. @return false (and keeps blocking I/O) if io_uring is unavailable */
+	bool enable_uring();
+	bool is_uring() {return rx!=NULL;}
+
 	bool isConnected() {return bConnected;}
 	bool isClient() {return bClient;}
 	bool isServer() {return !bClient;}
@@ -82,6 +101,8 @@ public:
 	bool hasMsg() {return waitForMsg(0);}
 
 	void write(void* buffer, size_t size);
+	/** Gathered write of n buffers in as few syscalls as possible */
+	void writev(struct iovec* iov, int n);
 	size_t read(void* buffer, size_t maxSize);
 	size_t read_exactly(void* buffer, size_t maxSize);
 
@@ -124,6 +145,10 @@ public:
 	}
 protected:
 	void connect(int nb_attempts = 1);
+	void init();
+	/** Refills rdata with the next received chunk */
+	void fill();
+	void arm();
 };
 
 
@@ -0,0 +1,174 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#include "Uring.h"
+
+#ifndef AGML_URING
+
+bool uring_is_available() { return false; }
+
+#else
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+
+static inline int io_uring_setup(unsigned entries, struct io_uring_params* p) { return (int)syscall(__NR_io_uring_setup, entries, p); }
+static inline int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, _NSIG/8);
+}
+static inline int io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) { return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args); }
+
+
+Uring::Uring() {
+	fd = -1;
+	sq_ptr = cq_ptr = MAP_FAILED; sqes = (struct io_uring_sqe*)MAP_FAILED;
+	sq_local_tail = nb_queued = 0;
+	br = (struct io_uring_buf_ring*)MAP_FAILED; br_size = 0;
+	br_entries = br_tail = 0;
+	bufs = 0; buf_size = 0;
+}
+
+Uring::~Uring() {
+	if(br!=MAP_FAILED) munmap(br, br_size);
+	if(sqes!=MAP_FAILED) munmap(sqes, sqes_size);
+	if(cq_ptr!=MAP_FAILED && cq_ptr!=sq_ptr) munmap(cq_ptr, cq_size);
+	if(sq_ptr!=MAP_FAILED) munmap(sq_ptr, sq_size);
+	if(fd>=0) close(fd);
+	delete[] bufs;
+}
+
+bool Uring::init(unsigned entries) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	if((fd = io_uring_setup(entries, &p)) < 0) return false;
+	this->entries = p.sq_entries;
+
+	sq_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+	cq_size = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP) sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+	sq_ptr = mmap(0, sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(sq_ptr==MAP_FAILED) return false;
+	cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP) ? sq_ptr : mmap(0, cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if(cq_ptr==MAP_FAILED) return false;
+	sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+	sqes = (struct io_uring_sqe*)mmap(0, sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(sqes==MAP_FAILED) return false;
+
+	sq_head = (unsigned*)((char*)sq_ptr + p.sq_off.head);
+	sq_tail = (unsigned*)((char*)sq_ptr + p.sq_off.tail);
+	sq_mask = (unsigned*)((char*)sq_ptr + p.sq_off.ring_mask);
+	sq_array = (unsigned*)((char*)sq_ptr + p.sq_off.array);
+	cq_head = (unsigned*)((char*)cq_ptr + p.cq_off.head);
+	cq_tail = (unsigned*)((char*)cq_ptr + p.cq_off.tail);
+	cq_mask = (unsigned*)((char*)cq_ptr + p.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe*)((char*)cq_ptr + p.cq_off.cqes);
+	sq_local_tail = *sq_tail;
+	return true;
+}
+
+bool Uring::init_buffers(unsigned nb, size_t size, int bgid) {
+	br_entries = nb;
+	br_size = nb*sizeof(struct io_uring_buf);
+	br = (struct io_uring_buf_ring*)mmap(0, br_size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+	if(br==MAP_FAILED) return false;
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)br;
+	reg.ring_entries = nb;
+	reg.bgid = bgid;
+	if(io_uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return false;
+
+	buf_size = size;
+	bufs = new unsigned char[nb*size];
+	br_tail = 0;
+	for(unsigned i=0; i<nb; i++) recycle(i);
+	return true;
+}
+
+void Uring::recycle(int bid) {
+	// Not br->bufs : in C++ the header's flexible array member is misplaced, entries overlay the ring from its start
+	struct io_uring_buf* b = (struct io_uring_buf*)br + (br_tail & (br_entries-1));
+	b->addr = (unsigned long)buffer(bid);
+	b->len = buf_size;
+	b->bid = bid;
+	__atomic_store_n(&br->tail, (unsigned short)++br_tail, __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe* Uring::get_sqe() {
+	if(sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= entries) {
+		// The kernel takes the queued SQEs at submission : flush them to make room
+		if(submit() < 0 || sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= entries) return NULL;
+	}
+	unsigned i = sq_local_tail & *sq_mask;
+	struct io_uring_sqe* sqe = &sqes[i];
+	memset(sqe, 0, sizeof(*sqe));
+	sq_array[i] = i;
+	sq_local_tail++;
+	nb_queued++;
+	return sqe;
+}
+
+int Uring::submit(unsigned wait_nr) {
+	__atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+	int r;
+	do r = io_uring_enter(fd, nb_queued, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+	while(r<0 && errno==EINTR);
+	if(r>=0) nb_queued = 0;
+	return r;
+}
+
+struct io_uring_cqe* Uring::next_cqe(bool bWait) {
+	for(;;) {
+		unsigned head = *cq_head;
+		if(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return &cqes[head & *cq_mask];
+		if(!bWait) return NULL;
+		if(io_uring_enter(fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno!=EINTR) return NULL;
+	}
+}
+
+void Uring::cqe_seen() {
+	__atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool uring_is_available() {
+	Uring u;
+	return u.init(2) && u.init_buffers(1, 64, 0);
+}
+
+#endif
@@ -0,0 +1,101 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#ifndef AGML_URING_H_
+#define AGML_URING_H_
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#ifdef AGML_HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+/** @return true if this build and the running kernel support io_uring multishot receives */
+bool uring_is_available();
+
+
+/** io_uring receive (multishot, into a provided buffer ring) and send is only built where the kernel headers support it */
+#if defined(AGML_HAVE_IO_URING) && defined(IORING_RECV_MULTISHOT)
+#define AGML_URING 1
+
+
+/**
+ * Minimal io_uring ring for one socket, through raw syscalls (no liburing dependency).
+ * A Uring is used by a single thread at a time : Socket keeps one for its reader and one for its writers.
+ */
+class Uring {
+public:
+	Uring();
+	~Uring();
+
+	/** @return false if io_uring is unavailable (old kernel, disabled, ...) */
+	bool init(unsigned entries);
+
+	/** Registers nb (a power of 2) buffers of size bytes as buffer group bgid, for multishot receives */
+	bool init_buffers(unsigned nb, size_t size, int bgid);
+	inline unsigned char* buffer(int bid) { return bufs + bid*buf_size; }
+	/** Gives buffer bid back to the kernel */
+	void recycle(int bid);
+
+	/** @return a free SQE, submitting the queued ones if the ring is full (NULL if that fails) */
+	struct io_uring_sqe* get_sqe();
+	/** Submits the queued SQEs and waits for wait_nr completions */
+	int submit(unsigned wait_nr = 0);
+
+	/** @return the next completion, waiting for it unless bWait is false (then NULL if none) */
+	struct io_uring_cqe* next_cqe(bool bWait = true);
+	void cqe_seen();
+
+	inline int get_fd() { return fd; }
+
+private:
+	int fd;
+	unsigned entries;
+
+	void* sq_ptr; size_t sq_size;
+	void* cq_ptr; size_t cq_size;
+	struct io_uring_sqe* sqes; size_t sqes_size;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe* cqes;
+	unsigned sq_local_tail, nb_queued;
+
+	struct io_uring_buf_ring* br; size_t br_size;
+	unsigned br_entries, br_tail;
+	unsigned char* bufs; size_t buf_size;
+};
+
+#endif
+
+#endif /* AGML_URING_H_ */
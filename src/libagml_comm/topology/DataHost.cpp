@@ -41,6 +41,8 @@ array<DataHost*> data_hosts;
 
 DataHost::DataHost(const std::string& host_name, const std::string& server_ip, int nb_threads): nb_threads(nb_threads) {
 	host = NULL;
+	nb_streams = 1;
+	state = DATAHOST_DISCONNECTED;
 	if(agml_get_datahost(host_name)!=NULL) throw std::runtime_error(TOSTRING("A DataHost with the same host_name already exists : " << host_name));
 
 	this->server_ip = server_ip;
@@ -55,8 +57,43 @@ DataHost::~DataHost() {
 
 void DataHost::connect() {
 	if(is_local() || is_connected()) return;
-	host = new Host(new Socket(server_ip.c_str()),false);
-	host->send_sys_command("data_host", agml_get_first_local_datahost()->host_name);
+	std::string me = agml_get_first_local_datahost()->host_name;
+	Host* h = new Host(new Socket(server_ip.c_str(), true),false);
+	h->peer = this;
+	h->send_sys_command("data_host", me);
+	h->send_sys_command("credit", TOSTRING(AGML_NET_CREDITS));
+	h->send_sys_command("wire_offer", TOSTRING(AGML_WIRE_VERSION));
+	for(int i=1; i<nb_streams; i++) {
+		Host* s = new Host(new Socket(server_ip.c_str(), true),false);
+		s->peer = this;
+		s->send_sys_command("data_stream", me);
+		s->send_sys_command("wire_offer", TOSTRING(AGML_WIRE_VERSION));
+		streams.add(s);
+	}
+	// Senders may use the streams as soon as host is set
+	__sync_synchronize();
+	host = h;
+}
+
+static void* _datahost_connect_thread(void* p) {
+	DataHost* h = (DataHost*)p;
+	try {
+		h->connect();
+		h->state = DATAHOST_CONNECTED;
+	} catch(std::exception& e) {
+		ERROR("ERROR: Couldn't connect to host " << h->host_name << " : " << e.what());
+		h->state = DATAHOST_FAILED;
+	}
+	return NULL;
+}
+
+void DataHost::connect_async() {
+	if(is_local() || is_connected()) return;
+	int s = state;
+	if(s==DATAHOST_CONNECTING || s==DATAHOST_CONNECTED || !__sync_bool_compare_and_swap(&state, s, DATAHOST_CONNECTING)) return;
+	pthread_t th;
+	if(pthread_create(&th, NULL, _datahost_connect_thread, this)) { state = DATAHOST_FAILED; return; }
+	pthread_detach(th);
 }
 
 DataHost* agml_get_datahost(const std::string host_name) {
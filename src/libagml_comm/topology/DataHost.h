@@ -38,20 +38,38 @@ knowledge of the CeCILL license and that you accept its terms.
 #include "../common/com.h"
 #include "../common/Host.h"
 
+/** DataHost connection states (see DataHost::connect_async) */
+#define DATAHOST_DISCONNECTED 0
+#define DATAHOST_CONNECTING 1
+#define DATAHOST_CONNECTED 2
+#define DATAHOST_FAILED 3
+
 class DataHost {
 public:
 	std::string host_name;
 	std::string server_ip;
 	int nb_threads;
 	Host* host;
+
+	/** Number of parallel connections to open to this host (1 by default) */
+	int nb_streams;
+	/** Additional connections, besides host */
+	array<Host*> streams;
+	Reassembler reassembler;
+
+	volatile int state;
 public:
 	DataHost(const std::string& host_name, const std::string& server_ip = "", int nb_threads = 1);
 	virtual ~DataHost();
 
 	inline bool is_local() { return server_ip.empty() || com_is_my_ip(server_ip); }
 	inline bool is_connected() {return host!=0 && host->is_connected(); }
+	inline bool is_failed() {return state==DATAHOST_FAILED; }
 
+	/** Connects (with retries), publishing host once all streams are up */
 	void connect();
+	/** Connects in the background : sends to this host fail until it is connected */
+	void connect_async();
 };
 
 
@@ -34,6 +34,7 @@ knowledge of the CeCILL license and that you accept its terms.
 #include "NodeGroup.h"
 #include "../common/com.h"
 #include "../simulation/Thread.h"
+#include "../common/Udp.h"
 #include "Info.h"
 #include "NodeLibrary.h"
 #include <stdexcept>
@@ -48,6 +49,11 @@ NodeGroup::NodeGroup(const std::string& name, const std::string& nodeclass) : na
 	id = -1;
 	nb_local_nodes = 0;
 	nb_nodes = 0;
+	routes = 0;
+	bConflate = false;
+	mailbox_size = mailbox_bytes = 0;
+	send_timeout = 0;
+	bUdp = false;
 }
 
 
@@ -66,6 +72,7 @@ void NodeGroup::add_out(Link* l) {
 	outs.add(l);
 	l->dst->connect_hosts_as_needed();
 	nb_out_nodes += l->get_nb_out();
+	invalidate_routes();
 }
 
 void NodeGroup::remove_in(Link* in) {
@@ -75,6 +82,7 @@ void NodeGroup::remove_in(Link* in) {
 
 void NodeGroup::remove_out(Link* out) {
 	this->outs.remove(out);
+	invalidate_routes();
 	throw std::runtime_error("NOT IMPLEMENTED YET !");
 }
 
@@ -123,11 +131,9 @@ bool NodeGroup::has_local_out() {
 }
 
 Node* NodeGroup::get_local_node(size_t id) {
-	for(uint i=0; i<local_hosts.size(); i++) {
-		if(id < local_hosts[i]->nb_nodes) return local_hosts[i]->nodes[id];
-		id -= local_hosts[i]->nb_nodes;
-	}
-	return NULL;
+	rcu_read l(routes_rcu);
+	RoutingTable* r = get_routes();
+	return id < r->nodes.size() ? r->nodes[id].node : NULL;
 }
 
 
@@ -145,41 +151,127 @@ NodeGroupHost* NodeGroup::get_first_host(const std::string& host_name) {
 // COMMUNICATION
 
 bool NodeGroup::send_out(Node* src, uint iNeighbor, Message& m) {
-	uint _iNeighbor = iNeighbor;
+	RoutingTable::Out out;
+	{
+		rcu_read l(routes_rcu);
+		RoutingTable* r = get_routes();
+		if(iNeighbor >= r->outs.size())
+			throw std::runtime_error(TOSTRING("Neighbor overflow for group " << name << " out n°" << iNeighbor << " (outs are ["<< dump_outs() << "])"));
+		out = r->outs[iNeighbor];
+	}
 	m.src = (((long)id << 32) | src->id);
-	for(uint i=0; i<outs.size(); i++) {
-		if(_iNeighbor < outs[i]->get_nb_out()) {
-			try {
-				outs[i]->dst->send(src, outs[i]->get_out_node_id(src->id, _iNeighbor), m);
-				return true;
-			} catch(std::exception& e) {return false;}
+	try {
+		return out.dst->send(src, (out.bSkipSelf && out.id >= (uint)src->id) ? out.id+1 : out.id, m);
+	} catch(std::exception& e) {return false;}
+}
+
+/** @return false if the destination can't accept the message (full mailbox, or no credit left on the remote host) */
+bool NodeGroup::send(Node* src, uint dst, Message& m) {
+	RoutingTable::Dst d;
+	{
+		rcu_read l(routes_rcu);
+		RoutingTable* r = get_routes();
+		if(dst>=r->nodes.size()) throw std::runtime_error(TOSTRING("Node id overflow for group " << name << " node n°" << dst));
+		d = r->nodes[dst];
+	}
+	long timeout = src->node_group->send_timeout;
+	if(d.node) {
+		m.dst = (((long)id) << 32) | dst;
+		if(src->thread == d.node->thread) d.node->_receive(&m);
+		else {
+			if(!d.node->thread->wait_room(d.node, m, timeout)) return false;
+			Message* c = m.copy();
+			if(!d.node->thread->push_message(c, d.node)) { delete c; return false; }
 		}
-		_iNeighbor -= outs[i]->get_nb_out();
+	} else if(d.host) {
+		if(!d.host->is_connected()) throw std::runtime_error(TOSTRING("Couldn't send to " << (d.host->host ? d.host->host->host_name : "?") << " : " << "DataHost not connected"));
+		Host* h = d.host->host->host;
+		m.dst = (((long)id) << 32) | d.remote_id;
+		if(src->node_group->bUdp && src->is_loss_tolerant(m.channel) && udp_send(src, d.host->host, m)) return true;
+		if(!h->wait_credit(timeout)) return false;
+		h->send(&m);
 	}
-	throw std::runtime_error(TOSTRING("Neighbor overflow for group " << name << " out n°" << iNeighbor << " (outs are ["<< dump_outs() << "])"));
+	else throw std::runtime_error(TOSTRING("Node id overflow for group " << name << " node n°" << dst));
+	return true;
 }
 
-void NodeGroup::send(Node* src, uint dst, Message& m) {
-	if(dst<0 || dst>=nb_nodes) throw std::runtime_error(TOSTRING("Node id overflow for group " << name << " node n°" << dst));
-	if(dst<nb_local_nodes) {
-		Node* n = get_local_node(dst);
-		m.dst = (((long)id) << 32) | dst;
-		if(src->thread == n->thread) n->_receive(&m);
-		else n->thread->push_message(m.copy());
-	} else {
-		dst -= nb_local_nodes;
-		for(uint i=0; i<hosts.size(); i++) {
-			if(hosts[i]->is_local()) continue;
-			if(dst < hosts[i]->nb_nodes) {
-				if(!hosts[i]->host->is_connected()) throw std::runtime_error(TOSTRING("Couldn't send to " << hosts[i]->host->host_name << " : " << "DataHost not connected"));
-				m.dst = (((long)id) << 32) | dst;
-				hosts[i]->host->host->send(&m);
-				return;
+
+/** Local destinations each get their own copy (unless on src's thread), remote hosts a single message listing theirs */
+int NodeGroup::multicast(Node* src, const std::vector<uint>& dsts, Message& m) {
+	long timeout = src->node_group->send_timeout;
+	std::map<NodeGroupHost*, std::vector<long> > remote;
+	int nb = 0;
+	for(uint i=0; i<dsts.size(); i++) {
+		RoutingTable::Dst d;
+		{
+			rcu_read l(routes_rcu);
+			RoutingTable* r = get_routes();
+			if(dsts[i]>=r->nodes.size()) throw std::runtime_error(TOSTRING("Node id overflow for group " << name << " node n°" << dsts[i]));
+			d = r->nodes[dsts[i]];
+		}
+		if(d.node) {
+			m.dst = (((long)id) << 32) | dsts[i];
+			if(src->thread == d.node->thread) d.node->_receive(&m);
+			else {
+				if(!d.node->thread->wait_room(d.node, m, timeout)) continue;
+				Message* c = m.copy();
+				if(!d.node->thread->push_message(c, d.node)) { delete c; continue; }
 			}
-			dst -= hosts[i]->nb_nodes;
+			nb++;
 		}
-		throw std::runtime_error(TOSTRING("Remote node id overflow for group " << name << " node n°" << dst));
+		else if(d.host) remote[d.host].push_back((((long)id) << 32) | d.remote_id);
 	}
+
+	for(std::map<NodeGroupHost*, std::vector<long> >::iterator i = remote.begin(); i!=remote.end(); i++) {
+		if(!i->first->is_connected()) continue;
+		Host* h = i->first->host->host;
+		if(!h->wait_credit(timeout)) continue;
+		m.dst = AGML_MULTICAST;
+		m.add((unsigned char*)&i->second[0], i->second.size()*sizeof(long));
+		try { h->send(&m); nb += i->second.size(); }
+		catch(std::exception& e) { ERROR("ERROR : Couldn't multicast to " << h->server_ip << " : " << e.what()); }
+		m.pop_back();
+	}
+	return nb;
+}
+
+int NodeGroup::broadcast(Node* src, Message& m) {
+	m.src = (((long)id << 32) | src->id);
+
+	// Group the out-neighbours by destination group, so that each group multicasts once
+	std::map<NodeGroup*, std::vector<uint> > dsts;
+	{
+		rcu_read l(routes_rcu);
+		RoutingTable* r = get_routes();
+		for(uint i=0; i<r->outs.size(); i++) {
+			const RoutingTable::Out& out = r->outs[i];
+			dsts[out.dst].push_back((out.bSkipSelf && out.id >= (uint)src->id) ? out.id+1 : out.id);
+		}
+	}
+
+	int nb = 0;
+	for(std::map<NodeGroup*, std::vector<uint> >::iterator i = dsts.begin(); i!=dsts.end(); i++) {
+		try { nb += i->first->multicast(src, i->second, m); }
+		catch(std::exception& e) { ERROR("ERROR : Broadcast from " << name << " to " << i->first->name << " failed : " << e.what()); }
+	}
+	return nb;
+}
+
+
+// ROUTING
+
+void NodeGroup::invalidate_routes() {
+	pthread_mutex_lock(&routes_mut);
+	RoutingTable* old = routes;
+	routes = 0;
+	pthread_mutex_unlock(&routes_mut);
+	if(!old) return;
+
+	// Readers may be compiling the next table under routes_mut : wait for them without it
+	pthread_mutex_lock(&retire_mut);
+	routes_rcu.synchronize();
+	pthread_mutex_unlock(&retire_mut);
+	delete old;
 }
 
 
@@ -223,6 +315,8 @@ void NodeGroup::add_host(NodeGroupHost* h) {
 	for(uint i=0; i<ins.size(); i++) ins[i]->on_dst_add_host(h);
 	for(uint i=0; i<outs.size(); i++) outs[i]->on_src_add_host(h);
 	this->nb_nodes += h->nb_nodes;
+	invalidate_routes();
+	for(uint i=0; i<ins.size(); i++) ins[i]->src->invalidate_routes();
 }
 
 void NodeGroup::connect_hosts_as_needed() {
@@ -233,11 +327,52 @@ void NodeGroup::connect_hosts_as_needed() {
 	}
 	if(!needed) return;
 
+	// All hosts are connected in parallel, in the background : our nodes start meanwhile
 	for(uint i=0; i<hosts.size(); i++) {
 		if(hosts[i]->is_connected() || hosts[i]->is_local()) continue;
-		try {	hosts[i]->connect(); }
-		catch(std::exception& e) { ERROR("ERROR: Couldn't connect to host " << hosts[i]->host->host_name); hosts[i]->host = 0;}
+		hosts[i]->connect();
+	}
+}
+
+void NodeGroup::on_property_set(const std::string& key) {
+	if(key=="conflate") bConflate = get_property_int(key, 0)!=0;
+	else if(key=="mailbox_size") mailbox_size = get_property_int(key, 0);
+	else if(key=="mailbox_bytes") mailbox_bytes = get_property_int(key, 0);
+	else if(key=="send_timeout") send_timeout = get_property_int(key, 0);
+	else if(key=="udp") bUdp = get_property_int(key, 0)!=0;
+}
+
+RoutingTable* NodeGroup::compile_routes() {
+	pthread_mutex_lock(&routes_mut);
+	RoutingTable* r = routes;
+	if(r) { pthread_mutex_unlock(&routes_mut); return r; }
+	r = new RoutingTable();
+
+	RoutingTable::Out o;
+	for(uint i=0; i<outs.size(); i++) {
+		o.dst = outs[i]->dst;
+		o.bSkipSelf = !outs[i]->bAllowSelf && outs[i]->is_self();
+		size_t nb = outs[i]->get_nb_out();
+		for(o.id=0; o.id<nb; o.id++) r->outs.push_back(o);
+	}
+
+	RoutingTable::Dst d;
+	d.node = 0; d.host = 0; d.remote_id = 0;
+	for(uint i=0; i<local_hosts.size(); i++) {
+		for(uint j=0; j<local_hosts[i]->nb_nodes; j++) { d.node = local_hosts[i]->nodes[j]; r->nodes.push_back(d); }
 	}
+	d.node = 0;
+	r->nodes.resize(nb_local_nodes, d);
+	for(uint i=0; i<hosts.size(); i++) {
+		if(hosts[i]->is_local()) continue;
+		d.host = hosts[i];
+		for(d.remote_id=0; d.remote_id<hosts[i]->nb_nodes; d.remote_id++) r->nodes.push_back(d);
+	}
+
+	__sync_synchronize();
+	routes = r;
+	pthread_mutex_unlock(&routes_mut);
+	return r;
 }
 
 
@@ -292,9 +427,9 @@ void NodeGroupHost::init(NodeGroup* g, DataHost* h, long nb_nodes, int thread) {
 }
 
 void NodeGroupHost::init_infos() {
-	std::string f = TOSTRING("/agml_" << g->name << "@" << host->host_name << ".log");
-	infos = (NodeGroupHostInfo*) shared_mem(f, sizeof(NodeGroupHostInfo));
-	infos->init();
+	stats = stats_alloc_group_host();
+	stats.init();
+	stats.group() = g->id;
 }
 
 std::string NodeGroupHost::get_state() {
@@ -302,6 +437,7 @@ std::string NodeGroupHost::get_state() {
 	if(bError) return state;
 	if(is_local()) state = "local";
 	else if(is_connected()) state = "connected";
+	else if(host->state==DATAHOST_CONNECTING) state = "connecting";
 	else if(!is_error()) state = "not connected";
 	return state;
 }
@@ -313,11 +449,9 @@ std::string NodeGroupHost::get_state() {
 
 void NodeGroupHost::connect() {
 	if(host->is_local() || host->is_connected()) return;
-	bError = true;
 	DBG("Connect to " << g->name << "@" <<  host->host_name << " (ip=" << host->server_ip << ")");
-	host->connect();
 	bIsLocal = false;
-	bError = false;
+	host->connect_async();
 }
 
 
@@ -325,57 +459,107 @@ void NodeGroupHost::connect() {
 // Local
 
 
+/** Nodes created by a worker for one simulation thread */
+struct _instantiation { NodeFactory* factory; long nb; std::vector<Node*> nodes; };
+
+static void* _instantiate_thread(void* p) {
+	_instantiation* job = (_instantiation*)p;
+	try { job->factory->instantiate(job->nb, job->nodes); }
+	catch(std::exception& e) { ERROR("ERROR while instantiating " << job->factory->nodeclass << " : " << e.what()); }
+	return NULL;
+}
+
 /**
  * @param thread : <0 = evenly distribute on all threads
  * (rem: the lightest thread gets more nodes if nb_nodes is not a multiple of the number of threads)
+ * Each thread's nodes are created contiguously by a worker of its own, in parallel. They are then registered in order,
+ * and init() later runs on their thread (see Thread::run()).
  */
 void NodeGroupHost::instantiate_nodes(long nb_nodes, int thread) {
+	long t0 = get_time_ms();
+	NodeFactory* factory = node_library_get_factory(g->nodeclass);
+	if(!factory) {
+		ERROR("Couldn't instantiate node class " << g->nodeclass);
+		return;
+	}
+	int th = thread;
+	std::vector<_instantiation*> jobs(threads.size(), (_instantiation*)NULL);
 	if(thread < 0) {
-		int th = threads_get_lightest();
-
-		int nb_per_thread = nb_nodes / threads.size();
-		int nb_remaining = nb_nodes - nb_per_thread*threads.size();
-
-		if(nb_remaining > 0) instantiate_nodes(nb_remaining, th);
-		if(nb_per_thread > 0) {
-			for(uint i=0; i<threads.size(); i++) instantiate_nodes(nb_per_thread, (i+th)%threads.size());
+		th = threads_get_lightest();
+		long nb_per_thread = nb_nodes / threads.size();
+		long nb_remaining = nb_nodes - nb_per_thread*threads.size();
+		for(uint i=0; i<threads.size(); i++) {
+			long nb = nb_per_thread + ((int)i==th ? nb_remaining : 0);
+			if(nb>0) { jobs[i] = new _instantiation; jobs[i]->nb = nb; }
 		}
 	} else {
-		if(nb_nodes<0) nb_nodes = 1;
+		jobs[thread] = new _instantiation;
+		jobs[thread]->nb = nb_nodes<0 ? 1 : nb_nodes;
+	}
 
-		DBG("Instantiate " << nb_nodes << " nodes for group " << g->name << " (on thread "<< thread << ")");
+	std::vector<pthread_t> workers(threads.size());
+	std::vector<bool> bWorker(threads.size(), false);
+	for(uint i=0; i<threads.size(); i++) {
+		if(!jobs[i]) continue;
+		jobs[i]->factory = factory;
+		bWorker[i] = !pthread_create(&workers[i], NULL, _instantiate_thread, jobs[i]);
+		if(!bWorker[i]) _instantiate_thread(jobs[i]);
+	}
 
-		threads[thread]->LOCK();
-		for(uint i=0; i<nb_nodes; i++) instantiate_node(thread);
-		threads[thread]->UNLOCK();
+	long nb = 0, nb_threads = 0;
+	for(uint k=0; k<threads.size(); k++) {
+		uint i = (k+th)%threads.size();
+		if(!jobs[i]) continue;
+		if(bWorker[i]) pthread_join(workers[i], NULL);
+		threads[i]->LOCK();
+		for(size_t j=0; j<jobs[i]->nodes.size(); j++) add(jobs[i]->nodes[j], threads[i]);
+		threads[i]->UNLOCK();
+		nb += jobs[i]->nodes.size();
+		nb_threads++;
+		delete jobs[i];
 	}
+	g->invalidate_routes();
+	DBG("Instantiated " << nb << " nodes for group " << g->name << " on " << nb_threads << " threads in " << get_time_ms()-t0 << " ms");
 }
 
 void NodeGroupHost::instantiate_nodes_same_as(NodeGroupHost* h, long limit) {
 	long nb = 0;
 	DBG("Instantiate " << h->nb_nodes << " nodes for group " << g->name << " exactly as " << h->g->name);
+	NodeFactory* f = node_library_get_factory(g->nodeclass);
 	for(uint i=0; i<h->nb_nodes && (limit==-1 || nb<limit); i++) {
-		h->nodes[i]->thread->LOCK();
-		if(!instantiate_node(h->nodes[i]->thread)) return;
-		h->nodes[i]->thread->UNLOCK();
+		Node *n = f ? f->instantiate() : NULL;
+		if(!n) {
+			ERROR("Couldn't instantiate node class " << g->nodeclass);
+			break;
+		}
+		Thread* t = h->nodes[i]->thread;
+		t->LOCK();
+		add(n, t);
+		t->UNLOCK();
 		nb++;
 	}
+	if(nb>0) g->invalidate_routes();
 }
 
 bool NodeGroupHost::instantiate_node(Thread* t) {
-	Node *n = node_library_instanciate(g->nodeclass);
+	NodeFactory* f = node_library_get_factory(g->nodeclass);
+	Node *n = f ? f->instantiate() : NULL;
 	if(!n) {
 		ERROR("Couldn't instantiate node class " << g->nodeclass);
 		return false;
 	}
-	n->nodeclass = g->nodeclass;
-	add(n);
-	n->thread = t;
-	n->init();
-	t->add(n);
+	add(n, t);
+	g->invalidate_routes();
 	return true;
 }
 
+void NodeGroupHost::add(Node* node, Thread* t) {
+	node->nodeclass = g->nodeclass;
+	add(node);
+	node->thread = t;
+	t->add(node);
+}
+
 void NodeGroupHost::add(Node* node) {
 	node->node_group = g;
 	node->host = this;
@@ -389,22 +573,20 @@ void NodeGroupHost::add(Node* node) {
 // Events
 
 void NodeGroupHost::on_process() {
-	if(!infos) return;
-	infos->update();
-	infos->nbprocess_second++;
-	infos->nbProcess++;
+	if(!stats.valid()) return;
+	stats.nb_process()++;
 }
 
 void NodeGroupHost::on_send(size_t size) {
-	if(!infos) return;
-	infos->nbSend++;
-	infos->Ko_second+=size;
+	if(!stats.valid()) return;
+	stats.nb_sent()++;
+	stats.bytes_sent()+=size;
 }
 
 void NodeGroupHost::on_receive(size_t size) {
-	if(!infos) return;
-	infos->nbRecv++;
-	infos->Ko_r_second+=size;
+	if(!stats.valid()) return;
+	stats.nb_recv()++;
+	stats.bytes_recv()+=size;
 }
 
 
@@ -35,18 +35,47 @@ knowledge of the CeCILL license and that you accept its terms.
 #define NODEGROUP_H_
 
 #include <map>
+#include <vector>
 #include "../util/utils.h"
 #include "../util/array.h"
 #include "../agml/node.h"
 #include "../common/Host.h"
 #include "DataHost.h"
 #include "Info.h"
+#include "../simulation/Latency.h"
 
 
 class NodeGroupHost;
 class NodeInfo;
 class Link;
 
+
+/**
+ * Topology compiled into flat arrays, so that sending a message is a couple of lookups :
+ *  - outs : neighbour index -> (destination group, node index in that group)
+ *  - nodes : node index in this group -> local Node, or (remote host, node index on that host)
+ * Tables are immutable once built, and rebuilt lazily after any topology change.
+ * Readers copy what they need out of a table within a routes_rcu section : a replaced table is freed once they left.
+ */
+class RoutingTable {
+public:
+	struct Out {
+		NodeGroup* dst;
+		uint id;
+		bool bSkipSelf;		// self links skip the sender itself
+	};
+
+	struct Dst {
+		Node* node;
+		NodeGroupHost* host;
+		uint remote_id;
+	};
+
+	std::vector<Out> outs;
+	std::vector<Dst> nodes;
+};
+
+
 class NodeGroup {
 public:
 	int id;
@@ -66,6 +95,25 @@ public:
 
 	std::map<std::string, std::string> properties;
 
+	/** "conflate" property : only the newest pending message per source and channel is delivered */
+	bool bConflate;
+
+	/** "mailbox_size" and "mailbox_bytes" properties : bounds of each node's pending messages (0 = unbounded) */
+	long mailbox_size, mailbox_bytes;
+
+	/** "send_timeout" property : how long (ms) send() may wait for room in the target's mailbox */
+	long send_timeout;
+
+	/** "udp" property : messages of its nodes' loss-tolerant channels travel as best-effort datagrams (see Udp.h) */
+	bool bUdp;
+
+private:
+	RoutingTable* volatile routes;
+	rcu routes_rcu;
+	pthread_mutex_t routes_mut = PTHREAD_MUTEX_INITIALIZER;
+	/** Serializes the grace periods of routes_rcu */
+	pthread_mutex_t retire_mut = PTHREAD_MUTEX_INITIALIZER;
+
 public:
 	NodeGroup(const std::string& name, const std::string& nodeclass);
 
@@ -91,7 +139,10 @@ public:
 	Node* get_local_node(size_t id);
 
 
-	template <typename T> void set_property(const std::string& key, T& val) { properties[key] = TOSTRING(val); }
+	template <typename T> void set_property(const std::string& key, T& val) {
+		properties[key] = TOSTRING(val);
+		on_property_set(key);
+	}
 	std::string get_property(const std::string& key) {
 		if(!properties.count(key)) return "";
 		return properties[key];
@@ -106,7 +157,22 @@ public:
 
 
 	bool send_out(Node* src, uint iNeighbor, Message& m);
-	void send(Node* src, uint dst, Message& m);
+	bool send(Node* src, uint dst, Message& m);
+
+	/** Sends m to the given Nodes of this group, once per remote host. @return the number of Nodes reached */
+	int multicast(Node* src, const std::vector<uint>& dsts, Message& m);
+
+	/** Sends m to all out-neighbours of src. @return the number of Nodes reached */
+	int broadcast(Node* src, Message& m);
+
+	/** @return the current routing table, compiling it if the topology changed. Only valid within a routes_rcu section */
+	inline RoutingTable* get_routes() {
+		RoutingTable* r = routes;
+		return r ? r : compile_routes();
+	}
+
+	/** Must be called after any change affecting this group's outs or nodes */
+	void invalidate_routes();
 
 
 	///////////
@@ -123,6 +189,8 @@ private:
 
 	void add_host(NodeGroupHost* h);
 	void connect_hosts_as_needed();
+	void on_property_set(const std::string& key);
+	RoutingTable* compile_routes();
 };
 
 
@@ -137,7 +205,14 @@ public:
 	array<NodeInfo*> remote_infos;
 	size_t nb_nodes;
 
+	/** Last infos received for remote hosts */
 	NodeGroupHostInfo* infos;
+	/** Our record in the stats region, for local hosts */
+	GroupHostStats stats;
+
+	/** Last latency summaries received for remote hosts */
+	std::vector<LatencySummary> remote_latency;
+	pthread_mutex_t latency_mut = PTHREAD_MUTEX_INITIALIZER;
 
 	bool bError;
 	int bIsLocal;
@@ -168,7 +243,7 @@ public:
 	}
 
 	inline bool is_connected() {return host!=0 && host->is_connected();}
-	inline bool is_error() {return bError;}
+	inline bool is_error() {return bError || (host!=0 && host->is_failed());}
 
 	std::string get_state();
 
@@ -182,7 +257,10 @@ public:
 	// LOCAL INSTANTIATION //
 	/////////////////////////
 
+	/** Registers a node. Once done adding nodes, the caller invalidates g's routes */
 	void add(Node* node);
+	/** Adds a newly created node, to be run by thread t (same as add(node)) */
+	void add(Node* node, Thread* t);
 
 	void instantiate_nodes(long nb_nodes, int thread = -1);
 	void instantiate_nodes_same_as(NodeGroupHost* h, long limit = -1);
@@ -38,11 +38,16 @@ knowledge of the CeCILL license and that you accept its terms.
 #include <dlfcn.h>
 #include <dirent.h>
 #include <string>
+#include <map>
 
 static bool bInited = false;
 static array<void*> dl_handles;
 pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
 
+/** Resolved classes (NULL when not found) ; factories stay allocated, as callers may keep them */
+static std::map<std::string, NodeFactory*> factories;
+static pthread_mutex_t factories_mut = PTHREAD_MUTEX_INITIALIZER;
+
 void node_library_add_dir(const std::string& path);
 
 
@@ -86,19 +91,57 @@ void node_library_add(const std::string& shared_lib) {
 	void* h = dlopen(file_absolute_path(shared_lib).c_str(), RTLD_LAZY | RTLD_GLOBAL);
 
 	if(!h) ERROR("ERROR : Couldn't load shared nodeclass library " << shared_lib << " : " << dlerror());
-	else dl_handles.add(h);
+	else {
+		dl_handles.add(h);
+		// The new library may define or override classes : resolve them again
+		pthread_mutex_lock(&factories_mut);
+		factories.clear();
+		pthread_mutex_unlock(&factories_mut);
+	}
 }
 
-Node* node_library_instanciate(const std::string& nodeclass) {
-	if(!bInited) node_library_init();
-	Node* (*f) () = 0;
-	if(dl_handles.size()!=0) {
-		const char* instanciator = TOSTRING("__agml_node_instanciator_"<<nodeclass).c_str();
-		for(int i=dl_handles.size()-1; i>=0; i--) {
-			f= (Node* (*)())((unsigned long) dlsym(dl_handles[i], instanciator));
-			if(f) break;
-		}
+/** @return the symbol from the most recently loaded library that defines it */
+static void* node_library_lookup(const std::string& symbol) {
+	array<void*>::snapshot h(dl_handles);
+	for(int i=h.size()-1; i>=0; i--) {
+		void* f = dlsym(h[i], symbol.c_str());
+		if(f) return f;
 	}
+	return NULL;
+}
+
+NodeFactory* node_library_get_factory(const std::string& nodeclass) {
+	if(!bInited) node_library_init();
+	pthread_mutex_lock(&factories_mut);
+	std::map<std::string, NodeFactory*>::iterator i = factories.find(nodeclass);
+	if(i!=factories.end()) { pthread_mutex_unlock(&factories_mut); return i->second; }
+
+	NodeFactory* f = new NodeFactory(nodeclass);
+	f->create = (Node* (*)())((unsigned long) node_library_lookup(TOSTRING("__agml_node_instanciator_" << nodeclass)));
+	if(f->create) {
+		f->create_at = (Node* (*)(void*))((unsigned long) node_library_lookup(TOSTRING("__agml_node_placer_" << nodeclass)));
+		size_t (*size)() = (size_t (*)())((unsigned long) node_library_lookup(TOSTRING("__agml_node_size_" << nodeclass)));
+		if(size) f->size = size();
+	} else { delete f; f = NULL; }
+	factories[nodeclass] = f;
+	pthread_mutex_unlock(&factories_mut);
+	return f;
+}
+
+Node* node_library_instanciate(const std::string& nodeclass) {
+	NodeFactory* f = node_library_get_factory(nodeclass);
 	if(!f) {ERROR("Node Class not found : " << nodeclass); return 0;}
-	return f();
+	return f->instantiate();
+}
+
+size_t NodeFactory::instantiate(size_t n, std::vector<Node*>& nodes) {
+	nodes.reserve(nodes.size() + n);
+	if(!create_at || !size || n<2) {
+		for(size_t i=0; i<n; i++) nodes.push_back(create());
+		return n;
+	}
+	size_t stride = (size + 15) & ~(size_t)15;
+	char* block = new char[n*stride];
+	for(size_t i=0; i<n; i++) nodes.push_back(create_at(block + i*stride));
+	return n;
 }
@@ -35,8 +35,33 @@ knowledge of the CeCILL license and that you accept its terms.
 #define NODELIBRARY_H_
 
 #include "../agml/node.h"
+#include <vector>
+
+/** Factories of a node class, resolved once from the loaded libraries */
+class NodeFactory {
+public:
+	std::string nodeclass;
+	Node* (*create)();
+	/** In place constructor, and object size (NULL and 0 for libraries built without them) */
+	Node* (*create_at)(void*);
+	size_t size;
+
+	NodeFactory(const std::string& nodeclass) : nodeclass(nodeclass), create(0), create_at(0), size(0) {}
+
+	inline Node* instantiate() { return create(); }
+
+	/**
+	 * Appends n new nodes to <i>nodes</i>, allocated in a single block when the class reports its size.
+	 * Nodes are never deleted, so the block lives as long as the process.
+	 * @return the number of nodes created
+	 */
+	size_t instantiate(size_t n, std::vector<Node*>& nodes);
+};
 
 void node_library_add(const std::string& path);
+
+/** @return the cached factories of the given class, or NULL if no library exports it */
+NodeFactory* node_library_get_factory(const std::string& nodeclass);
 Node* node_library_instanciate(const std::string& nodeclass);
 
 #endif /* NODELIBRARY_H_ */
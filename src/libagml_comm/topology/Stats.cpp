@@ -0,0 +1,243 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#include "Stats.h"
+#include "Info.h"
+#include "../common/com.h"
+#include "../util/utils.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <map>
+
+/** Group hosts are written by all threads : each one gets a block of its own */
+#define STATS_GROUP_HOSTS_CAPACITY (256*STATS_BLOCK)
+
+static pthread_mutex_t stats_mut = PTHREAD_MUTEX_INITIALIZER;
+static StatsTable* tables[2] = {NULL, NULL};
+/** Including private ones, for the aggregator */
+static std::vector<StatsTable*> all_tables;
+
+/** Current block of each thread */
+struct StatsCursor { StatsTable* t; size_t next, end; StatsCursor() : t(0), next(0), end(0) {} };
+static std::map<int, StatsCursor> node_cursors;
+
+struct StatsFieldDesc { const char* name; uint32_t type; uint32_t size; };
+static inline uint32_t stats_type(float*) { return STATS_FLOAT; }
+static inline uint32_t stats_type(long*) { return STATS_LONG; }
+static inline uint32_t stats_type(bool*) { return STATS_BOOL; }
+#define STATS_DESC(type, name) {#name, stats_type((type*)0), sizeof(type)},
+static const StatsFieldDesc node_fields[] = { AGML_NODE_STATS(STATS_DESC) };
+static const StatsFieldDesc group_host_fields[] = { AGML_GROUP_HOST_STATS(STATS_DESC) };
+
+static inline size_t stats_align(size_t n) { return (n + STATS_CACHE_LINE-1) & ~(size_t)(STATS_CACHE_LINE-1); }
+
+/** Lays a table's arrays out from offset. @return the end of the last one */
+static size_t stats_layout(StatsTableHeader* h, const char* name, const StatsFieldDesc* f, uint32_t nb, uint64_t capacity, size_t offset) {
+	strncpy(h->name, name, sizeof(h->name)-1);
+	h->nb_fields = nb;
+	h->capacity = capacity;
+	h->nb_used = 0;
+	for(uint32_t i=0; i<nb; i++) {
+		strncpy(h->fields[i].name, f[i].name, sizeof(h->fields[i].name)-1);
+		h->fields[i].type = f[i].type;
+		h->fields[i].size = f[i].size;
+		h->fields[i].offset = offset;
+		offset = stats_align(offset + capacity*f[i].size);
+	}
+	return offset;
+}
+
+/** Creates a region holding both tables, in shared memory if a name is given (private memory otherwise, or if it can't be mapped) */
+static StatsHeader* stats_create_region(const std::string& name, uint64_t nb_nodes, uint64_t nb_group_hosts) {
+	StatsHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, STATS_MAGIC, sizeof(h.magic));
+	h.version = STATS_VERSION;
+	h.nb_tables = 2;
+	size_t end = stats_align(sizeof(StatsHeader));
+	end = stats_layout(&h.tables[STATS_TABLE_NODES], "nodes", node_fields, NodeStats::NB_FIELDS, nb_nodes, end);
+	end = stats_layout(&h.tables[STATS_TABLE_GROUP_HOSTS], "group_hosts", group_host_fields, GroupHostStats::NB_FIELDS, nb_group_hosts, end);
+	h.size = end;
+
+	char* base = NULL;
+	if(!name.empty()) {
+		shm_unlink(name.c_str());	// A fresh, zeroed one
+		base = (char*) shared_mem(name, end);
+		if(!base) ERROR("Couldn't map the stats region " << name << " : stats won't be visible to external readers");
+	}
+	if(!base) base = (char*) calloc(1, end);
+	memcpy(base, &h, sizeof(h));
+	return (StatsHeader*) base;
+}
+
+static void* _stats_aggregator_thread(void*) {
+	for(;;) {
+		sleep(1);
+		pthread_mutex_lock(&stats_mut);
+		std::vector<StatsTable*> t = all_tables;
+		pthread_mutex_unlock(&stats_mut);
+		long now = get_time_ms();
+		for(size_t i=0; i<t.size(); i++) t[i]->aggregate(now);
+	}
+	return NULL;
+}
+
+static void stats_init() {
+	if(tables[0]) return;
+	uint64_t nb_nodes = (AGML_STATS_CAPACITY + STATS_BLOCK-1) / STATS_BLOCK * STATS_BLOCK;
+	StatsHeader* h = stats_create_region(TOSTRING("/agml_stats_" << SERVER_PORT), nb_nodes, STATS_GROUP_HOSTS_CAPACITY);
+	for(int i=0; i<2; i++) all_tables.push_back(tables[i] = new StatsTable(&h->tables[i], (char*)h));
+
+	pthread_t th;
+	if(pthread_create(&th, NULL, _stats_aggregator_thread, NULL)) ERROR("ERROR : Couldn't start the stats aggregator");
+	else pthread_detach(th);
+}
+
+/** Called with stats_mut held. @return the first slot of a new block of the given table, in t */
+static size_t stats_alloc_block(int table, StatsTable*& t) {
+	stats_init();
+	long slot = tables[table]->alloc_block();
+	if(slot>=0) { t = tables[table]; return slot; }
+
+	static bool bWarned = false;
+	if(!bWarned) { ERROR("Stats region full (AGML_STATS_CAPACITY), further stats are only visible through infos"); bWarned = true; }
+	StatsHeader* h = stats_create_region("", table==STATS_TABLE_NODES ? STATS_BLOCK : 0, table==STATS_TABLE_GROUP_HOSTS ? STATS_BLOCK : 0);
+	t = new StatsTable(&h->tables[table], (char*)h);
+	all_tables.push_back(t);
+	return t->alloc_block();
+}
+
+
+
+/////////////////
+// STATS TABLE //
+/////////////////
+
+StatsTable::StatsTable(StatsTableHeader* h, char* base) : h(h) {
+	for(uint32_t i=0; i<h->nb_fields; i++) columns[i] = base + h->fields[i].offset;
+}
+
+long StatsTable::alloc_block() {
+	if(h->nb_used + STATS_BLOCK > h->capacity) return -1;
+	long slot = h->nb_used;
+	h->nb_used += STATS_BLOCK;
+	return slot;
+}
+
+void StatsTable::aggregate(long now) {
+	size_t n = h->nb_used;
+	for(int k=0; k<3; k++) if(last[k].size() < n) last[k].resize(n, 0);
+	long* nb_process = (long*) columns[NodeStats::F_nb_process];
+	long* bytes_sent = (long*) columns[NodeStats::F_bytes_sent];
+	long* bytes_recv = (long*) columns[NodeStats::F_bytes_recv];
+	float* ips = (float*) columns[NodeStats::F_ips];
+	float* Ko_s = (float*) columns[NodeStats::F_Ko_s];
+	float* Ko_r = (float*) columns[NodeStats::F_Ko_r];
+	long* lasttime = (long*) columns[NodeStats::F_lasttime];
+	for(size_t i=0; i<n; i++) {
+		long dt = now - lasttime[i];
+		if(lasttime[i]==0 || dt<=0) continue;
+		long p = nb_process[i], s = bytes_sent[i], r = bytes_recv[i];
+		ips[i] = ((long)((p - last[0][i])*10000/dt))/10.0;
+		Ko_s[i] = ((long)((s - last[1][i])*10/dt))/10.0;
+		Ko_r[i] = ((long)((r - last[2][i])*10/dt))/10.0;
+		last[0][i] = p; last[1][i] = s; last[2][i] = r;
+		lasttime[i] = now;
+	}
+}
+
+NodeStats stats_alloc_node(int thread) {
+	NodeStats s;
+	pthread_mutex_lock(&stats_mut);
+	StatsCursor& c = node_cursors[thread];
+	if(c.next==c.end) {
+		c.next = stats_alloc_block(STATS_TABLE_NODES, c.t);
+		c.end = c.next + STATS_BLOCK;
+	}
+	s.t = c.t;
+	s.slot = c.next++;
+	pthread_mutex_unlock(&stats_mut);
+	return s;
+}
+
+GroupHostStats stats_alloc_group_host() {
+	GroupHostStats s;
+	pthread_mutex_lock(&stats_mut);
+	s.slot = stats_alloc_block(STATS_TABLE_GROUP_HOSTS, s.t);
+	pthread_mutex_unlock(&stats_mut);
+	return s;
+}
+
+
+
+/////////////
+// RECORDS //
+/////////////
+
+template <class S, class I> static void stats_get(S& s, I& info) {
+	info.nbProcess = s.nb_process();
+	info.nbSend = s.nb_sent();
+	info.nbRecv = s.nb_recv();
+	info.ips = s.ips();
+	info.Ko_s = s.Ko_s();
+	info.Ko_r = s.Ko_r();
+	info.lasttime = s.lasttime();
+}
+
+#define STATS_ZERO(type, name) name() = 0;
+
+void NodeStats::init() {
+	AGML_NODE_STATS(STATS_ZERO)
+	lasttime() = get_time_ms();
+	bAttached() = true;
+}
+
+void NodeStats::get(NodeInfo& info) {
+	stats_get(*this, info);
+	info.bAttached = bAttached();
+	info.var1 = var1();
+	info.var2 = var2();
+}
+
+void GroupHostStats::init() {
+	AGML_GROUP_HOST_STATS(STATS_ZERO)
+	lasttime() = get_time_ms();
+}
+
+void GroupHostStats::get(NodeGroupHostInfo& info) {
+	stats_get(*this, info);
+	info.moy = moy();
+	info.var = var();
+}
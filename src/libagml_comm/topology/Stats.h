@@ -0,0 +1,159 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#ifndef AGML_STATS_H_
+#define AGML_STATS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class NodeInfo;
+class NodeGroupHostInfo;
+
+/**
+ * Statistics of all local nodes and group hosts live in a single shared memory region per daemon (/agml_stats_<port>).
+ * Each table stores its records as a structure of arrays : one array per field, each one starting on a cache line.
+ * Slots are handed out by blocks of STATS_BLOCK, one block per thread (or per group host),
+ * so that a cache line of any array is only written by a single thread.
+ * External readers find the layout in the StatsHeader at the start of the region. Slots whose lasttime is 0 are unused.
+ * Counters are cumulative, and only bumped on the hot path : the per second rates (ips, Ko_s, Ko_r)
+ * are computed every second by a background aggregator, lasttime telling when it last did.
+ */
+
+#define STATS_MAGIC "AGMLSTAT"
+#define STATS_VERSION 1
+#define STATS_CACHE_LINE 64
+#define STATS_BLOCK 16
+#define STATS_MAX_FIELDS 16
+
+#define STATS_TABLE_NODES 0
+#define STATS_TABLE_GROUP_HOSTS 1
+
+enum { STATS_FLOAT, STATS_LONG, STATS_BOOL };
+
+struct StatsField {
+	char name[24];
+	uint32_t type;
+	uint32_t size;
+	uint64_t offset;		// From the start of the region
+};
+
+struct StatsTableHeader {
+	char name[24];
+	uint32_t nb_fields;
+	uint32_t pad;
+	uint64_t capacity;
+	volatile uint64_t nb_used;
+	StatsField fields[STATS_MAX_FIELDS];
+};
+
+struct StatsHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t nb_tables;
+	uint64_t size;
+	StatsTableHeader tables[2];
+};
+
+/**
+ * Fields of each table (node is the id given by com_encode_local_node(), group the NodeGroup's id).
+ * Common fields come first, so that they have the same index in every table.
+ */
+#define AGML_COMMON_STATS(X) \
+	X(long, nb_process) X(long, nb_sent) X(long, nb_recv) X(long, bytes_sent) X(long, bytes_recv) \
+	X(float, ips) X(float, Ko_s) X(float, Ko_r) X(long, lasttime)
+#define AGML_NODE_STATS(X) AGML_COMMON_STATS(X) X(bool, bAttached) X(float, var1) X(float, var2) X(long, node)
+#define AGML_GROUP_HOST_STATS(X) AGML_COMMON_STATS(X) X(float, moy) X(float, var) X(long, group)
+
+
+class StatsTable {
+public:
+	StatsTableHeader* h;
+	char* columns[STATS_MAX_FIELDS];
+
+	/** Counters as of the last aggregation (nb_process, bytes_sent, bytes_recv), only used by the aggregator */
+	std::vector<long> last[3];
+
+	StatsTable(StatsTableHeader* h, char* base);
+
+	/** @return the first slot of a new block, or -1 if the table is full */
+	long alloc_block();
+
+	/** Computes the rates of all used slots since the last call */
+	void aggregate(long now);
+};
+
+
+#define STATS_FIELD_ID(type, name) F_##name,
+#define STATS_ACCESSOR(type, name) inline type& name() { return ((type*)t->columns[F_##name])[slot]; }
+
+/** Handle on a node's record */
+class NodeStats {
+public:
+	enum { AGML_NODE_STATS(STATS_FIELD_ID) NB_FIELDS };
+	StatsTable* t;
+	size_t slot;
+
+	NodeStats() : t(0), slot(0) {}
+	inline bool valid() { return t!=0; }
+	AGML_NODE_STATS(STATS_ACCESSOR)
+
+	void init();
+	void get(NodeInfo& info);
+};
+
+/** Handle on a group host's record */
+class GroupHostStats {
+public:
+	enum { AGML_GROUP_HOST_STATS(STATS_FIELD_ID) NB_FIELDS };
+	StatsTable* t;
+	size_t slot;
+
+	GroupHostStats() : t(0), slot(0) {}
+	inline bool valid() { return t!=0; }
+	AGML_GROUP_HOST_STATS(STATS_ACCESSOR)
+
+	void init();
+	void get(NodeGroupHostInfo& info);
+};
+
+
+/** @return a record for a node run by the given thread */
+NodeStats stats_alloc_node(int thread);
+
+/** @return a record for a group host (on a block of its own, as all threads write it) */
+GroupHostStats stats_alloc_group_host();
+
+
+#endif /* AGML_STATS_H_ */
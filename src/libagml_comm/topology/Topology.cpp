@@ -55,10 +55,14 @@ size_t Topology::nb_group_hosts() {
 
 void Topology::add(NodeGroup* g) {groups.add(g);}
 
-NodeGroup* Topology::get_group(int id) {return (uint)id >= groups.size() ? NULL : groups[id];}
+NodeGroup* Topology::get_group(int id) {
+	array<NodeGroup*>::snapshot g(groups);
+	return (uint)id >= g.size() ? NULL : g[id];
+}
 
 NodeGroup* Topology::get_group(const std::string& groupname) {
-	for(uint i=0; i<groups.size(); i++) if(groups[i]->name==groupname) return groups[i];
+	array<NodeGroup*>::snapshot g(groups);
+	for(uint i=0; i<g.size(); i++) if(g[i]->name==groupname) return g[i];
 	return NULL;
 }
 
@@ -71,7 +75,9 @@ void Topology::connect(NodeGroup* src, NodeGroup* dst, bool bAllowSelf, bool bOn
 
 #include "TopologyReader.h"
 void Topology::read(std::istream& s) {
+	long t = get_time_ms();
 	TopologyReader(s).read(this);
+	DBG("Topology read in " << get_time_ms()-t << " ms (" << nb_nodes() << " nodes)");
 	for(uint i=0; i<groups.size(); i++) groups[i]->connect_hosts_as_needed();
 	agml_threads_start();
 }
@@ -90,9 +96,40 @@ void Topology::dump_groups() {
 }
 
 
+/** Writes the infos of a local group host or node, as gathered from the stats region */
+static void write_infos(unsigned char*& p, NodeGroupHost* h, bool bWrite) {
+	NodeGroupHostInfo info;
+	if(bWrite && h->stats.valid()) h->stats.get(info);
+	ptrstream_write(p, h->stats.valid() ? &info : (NodeGroupHostInfo*)NULL, bWrite);
+}
+
+static void write_infos(unsigned char*& p, Node* n, bool bWrite) {
+	NodeInfo info;
+	if(bWrite && n->stats.valid()) n->stats.get(info);
+	ptrstream_write(p, n->stats.valid() ? &info : (NodeInfo*)NULL, bWrite);
+}
+
+/** Latency summaries of a group host : merged from our threads for local hosts, as last received for remote ones */
+static void get_latency(NodeGroupHost* h, std::vector<LatencySummary>& out) {
+	if(h->is_local()) latency_summarize(h->g->id, out);
+	else {
+		pthread_mutex_lock(&h->latency_mut);
+		out = h->remote_latency;
+		pthread_mutex_unlock(&h->latency_mut);
+	}
+}
+
+static void write_latency(unsigned char*& p, const std::vector<LatencySummary>& l, bool bWrite) {
+	size_t nb = l.size();
+	ptrstream_write(p, &nb, bWrite);
+	for(size_t i=0; i<nb; i++) ptrstream_write(p, &l[i], bWrite);
+}
+
 void Topology::dump_all_infos(Message* m) {
 	unsigned char* p = 0;
+	std::vector< std::vector<LatencySummary> > latency;	// gathered once, for both passes
 	for(int b=0; b<2; b++) {
+		size_t nb_latency = 0;
 		size_t nb_groups = groups.size();
 		ptrstream_write(p, &nb_groups, 										 b==1);
 		for(uint i=0; i<nb_groups; i++) {
@@ -103,10 +140,13 @@ void Topology::dump_all_infos(Message* m) {
 			for(uint j=0; j<nb_hosts; j++) {
 				ptrstream_write(p, groups[i]->hosts[j]->host->host_name,	 b==1);
 				ptrstream_write(p, &groups[i]->hosts[j]->nb_nodes,		 	 b==1);
-				ptrstream_write(p, groups[i]->hosts[j]->infos, 				 b==1);
+				if(groups[i]->hosts[j]->is_local()) write_infos(p, groups[i]->hosts[j], b==1);
+				else ptrstream_write(p, groups[i]->hosts[j]->infos, 		 b==1);
+				if(b==0) { latency.push_back(std::vector<LatencySummary>()); get_latency(groups[i]->hosts[j], latency.back()); }
+				write_latency(p, latency[nb_latency++],						 b==1);
 				for(uint k=0; k<groups[i]->hosts[j]->nb_nodes; k++) {
 					if(groups[i]->hosts[j]->is_local())
-						ptrstream_write(p, groups[i]->hosts[j]->nodes[k]->infos, b==1);
+						write_infos(p, groups[i]->hosts[j]->nodes[k], b==1);
 					else if(!groups[i]->hosts[j]->remote_infos.empty())
 						ptrstream_write(p, groups[i]->hosts[j]->remote_infos[k], b==1);
 					else ptrstream_write(p, (NodeInfo*)NULL, b==1);
@@ -124,7 +164,9 @@ void Topology::dump_all_infos(Message* m) {
 
 void Topology::dump_local_infos(Message* m) {
 	unsigned char* p = 0;
+	std::vector< std::vector<LatencySummary> > latency;
 	for(int b=0; b<2; b++) {
+		size_t nb_latency = 0;
 		size_t nb_groups = groups.size();
 		ptrstream_write(p, &nb_groups, 												 b==1);
 		for(uint i=0; i<nb_groups; i++) {
@@ -135,9 +177,11 @@ void Topology::dump_local_infos(Message* m) {
 			for(uint j=0; j<nb_local_hosts; j++) {
 				ptrstream_write(p, groups[i]->local_hosts[j]->host->host_name,		 b==1);
 				ptrstream_write(p, &groups[i]->local_hosts[j]->nb_nodes,		 	 b==1);
-				ptrstream_write(p, groups[i]->local_hosts[j]->infos, 				 b==1);
+				write_infos(p, groups[i]->local_hosts[j], 							 b==1);
+				if(b==0) { latency.push_back(std::vector<LatencySummary>()); get_latency(groups[i]->local_hosts[j], latency.back()); }
+				write_latency(p, latency[nb_latency++],								 b==1);
 				for(uint k=0; k<groups[i]->local_hosts[j]->nb_nodes; k++) {
-					ptrstream_write(p, groups[i]->local_hosts[j]->nodes[k]->infos,	 b==1);
+					write_infos(p, groups[i]->local_hosts[j]->nodes[k],				 b==1);
 				}
 			}
 		}
@@ -165,10 +209,18 @@ void Topology::update_infos(const unsigned char* p) {
 			size_t nb_nodes = ptrstream_read<size_t>(p);
 			if(h->infos==NULL) h->infos = new NodeGroupHostInfo();
 			ptrstream_read(p, h->infos);
+			size_t nb_latency = ptrstream_read<size_t>(p);
+			std::vector<LatencySummary> latency(nb_latency);
+			for(size_t l=0; l<nb_latency; l++) ptrstream_read(p, &latency[l]);
+			if(!h->is_local()) {
+				pthread_mutex_lock(&h->latency_mut);
+				h->remote_latency.swap(latency);
+				pthread_mutex_unlock(&h->latency_mut);
+			}
 			for(size_t k=0; k<nb_nodes; k++) {
 				if(h->is_local()) {
-					if(h->nodes[k]->infos==NULL) h->nodes[k]->infos = new NodeInfo();
-					ptrstream_read(p, h->nodes[k]->infos);
+					NodeInfo ignored;	// Our own stats are authoritative
+					ptrstream_read(p, &ignored);
 				} else {
 					if(h->remote_infos.empty()) for(size_t l = 0; l<h->nb_nodes; l++) h->remote_infos.add(new NodeInfo());
 					ptrstream_read(p, h->remote_infos[k]);
@@ -62,14 +62,20 @@ void TopologyReader::read_hosts() {
 
 DataHost* TopologyReader::parse_declare_host(const std::string& statement) {
 	std::string hostname = str_trim(str_before(statement, "="));
+	// Hosts may be known already, from a previous topology or because they connected to us before we got this one
 	DataHost* dh = agml_get_datahost(hostname);
-	if(dh) return dh;
-	dh = new DataHost(hostname);
+	if(!dh) dh = new DataHost(hostname);
 	dh->server_ip = str_trim(str_after(statement, "="));
 	dh->nb_threads = default_nb_threads;
 	if(str_has(dh->server_ip, " ")) {
-		dh->nb_threads = TOINT(str_trim(str_after(dh->server_ip, " ")));
+		// Options : [nb_threads] [streams=n]
+		std::istringstream options(str_after(dh->server_ip, " "));
 		dh->server_ip = str_trim(str_before(dh->server_ip, " "));
+		std::string o;
+		while(options >> o) {
+			if(str_starts_with(o, "streams=")) dh->nb_streams = MAX(1, TOINT(str_after(o, "=")));
+			else dh->nb_threads = TOINT(o);
+		}
 	}
 	return dh;
 }
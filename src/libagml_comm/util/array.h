@@ -35,59 +35,135 @@ knowledge of the CeCILL license and that you accept its terms.
 #define ARRAY_H_
 
 #include <pthread.h>
+#include <stdlib.h>
 #include <vector>
-#include <algorithm>
-
+#include "rcu.h"
+
+/**
+ * Read-mostly array : reads are lock-free, writes copy-on-write.
+ * Readers see immutable versions ; appends reuse the current buffer when it has room
+ * (older versions never look past their own size), other writes copy it.
+ * Old versions are freed once no reader can still hold them (see rcu.h) : in-place appends
+ * defer this to the next buffer change, so only reallocations and removals wait for readers.
+ * Use a snapshot to iterate over a consistent version.
+ */
 template <typename T> class array {
-	std::vector<T> v;
+	struct version {
+		T* items;
+		size_t size;
+		size_t capacity;
+	};
+
+	version* volatile cur;
+	std::vector<version*> retired;
+	rcu r;
 	pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+
 public:
-	array() {}
-	~array() {}
+	/** Consistent read-only view of the array, valid as long as the snapshot lives */
+	class snapshot {
+		array<T>& a;
+		version* v;
+		int e;
+	public:
+		snapshot(array<T>& a) : a(a) { e = a.r.read_lock(); v = a.cur; }
+		~snapshot() { a.r.read_unlock(e); }
+		inline size_t size() const { return v->size; }
+		inline bool empty() const { return v->size==0; }
+		inline const T& operator[](size_t i) const { return v->items[i]; }
+	private:
+		snapshot(const snapshot&);
+		snapshot& operator=(const snapshot&);
+	};
+
+public:
+	array() { cur = new_version(0, 0); }
+	~array() {
+		for(size_t i=0; i<retired.size(); i++) delete retired[i];
+		delete[] cur->items; delete cur;
+	}
 
 	inline void LOCK() {pthread_mutex_lock(&mut);}
 	inline void UNLOCK() {pthread_mutex_unlock(&mut);}
 
-	inline bool empty() {
-		LOCK();
-		bool b = v.empty();
-		UNLOCK();
-		return b;
-	}
+	inline bool empty() {	return size()==0; }
 
 	inline size_t size() {
-		LOCK();
-		size_t s = v.size();
-		UNLOCK();
+		int e = r.read_lock();
+		size_t s = cur->size;
+		r.read_unlock(e);
 		return s;
 	}
 
 	inline bool has(const T& t) {
-		LOCK();
-		bool b = std::find(v.begin(), v.end(), t) != v.end();
-		UNLOCK();
-		return b;
+		snapshot s(*this);
+		for(size_t i=0; i<s.size(); i++) if(s[i]==t) return true;
+		return false;
 	}
 
 	inline void add(const T& t) {
 		LOCK();
-		v.push_back(t);
+		version* v = cur;
+		version* nv;
+		if(v->size < v->capacity) nv = new_version(v->items, v->size+1, v->capacity);
+		else {
+			nv = new_version(new T[v->capacity ? v->capacity*2 : 4], v->size+1, v->capacity ? v->capacity*2 : 4);
+			for(size_t i=0; i<v->size; i++) nv->items[i] = v->items[i];
+		}
+		nv->items[v->size] = t;
+		publish(nv);
 		UNLOCK();
 	}
 
 	inline void remove(const T& t) {
 		LOCK();
-		vector_remove(v, t);
+		version* v = cur;
+		size_t i = 0;
+		while(i<v->size && !(v->items[i]==t)) i++;
+		if(i<v->size) {
+			version* nv = new_version(new T[v->capacity], v->size-1, v->capacity);
+			for(size_t j=0, k=0; j<v->size; j++) if(j!=i) nv->items[k++] = v->items[j];
+			publish(nv);
+		}
 		UNLOCK();
 	}
 
 	inline void clear() {
 		LOCK();
-		v.clear();
+		publish(new_version(0, 0));
 		UNLOCK();
 	}
 
-	inline const T& operator[](int i) const {	return v[i];	}
+	/** Unchecked read of the current version ; prefer a snapshot when the array may shrink meanwhile */
+	inline T operator[](int i) {
+		int e = r.read_lock();
+		T t = cur->items[i];
+		r.read_unlock(e);
+		return t;
+	}
+
+private:
+	array(const array&);
+	array& operator=(const array&);
+
+	static version* new_version(T* items, size_t size, size_t capacity = 0) {
+		version* v = new version;
+		v->items = items; v->size = size; v->capacity = capacity;
+		return v;
+	}
+
+	/** Called with mut held */
+	void publish(version* nv) {
+		version* old = cur;
+		__sync_synchronize();
+		cur = nv;
+		if(old->items == nv->items) { retired.push_back(old); return; }
+		r.synchronize();
+		delete[] old->items;
+		delete old;
+		for(size_t i=0; i<retired.size(); i++) delete retired[i];
+		retired.clear();
+	}
 };
 
 
@@ -194,3 +194,9 @@ long file_get_modification_time(const std::string& filename) {
 	stat(filename.c_str(), &attrib);
 	return attrib.st_ctim.tv_sec;
 }
+
+long file_get_size(const std::string& filename) {
+	struct stat attrib;
+	if(stat(filename.c_str(), &attrib)!=0) return -1;
+	return attrib.st_size;
+}
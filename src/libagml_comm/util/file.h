@@ -102,6 +102,7 @@ std::string main_dir();
 void create_dir_for(const std::string& filename);
 
 long file_get_modification_time(const std::string& filename);
+long file_get_size(const std::string& filename);
 
 
 #endif /* FILE_H_ */
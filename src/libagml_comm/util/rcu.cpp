@@ -0,0 +1,122 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#include "rcu.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef MEMBARRIER_CMD_PRIVATE_EXPEDITED
+#define MEMBARRIER_CMD_PRIVATE_EXPEDITED (1 << 3)
+#define MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED (1 << 4)
+#endif
+
+volatile unsigned long rcu_gp = 1;
+bool rcu_reader_fence = true;
+__thread rcu_reader* rcu_self = 0;
+
+static rcu_reader* volatile rcu_readers = 0;
+static pthread_mutex_t rcu_readers_mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t rcu_gp_mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t rcu_key;
+
+/** Forces a full memory barrier on every running thread of the process */
+static inline void rcu_membarrier() {
+#ifdef __NR_membarrier
+	if(!rcu_reader_fence && !syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0)) return;
+#endif
+	__sync_synchronize();
+}
+
+/** Slots of exited threads are reused by new ones */
+static void rcu_unregister_reader(void* p) {
+	rcu_reader* r = (rcu_reader*)p;
+	r->ctr = 0;
+	__sync_synchronize();
+	r->bUsed = false;
+}
+
+static struct rcu_init {
+	rcu_init() {
+		pthread_key_create(&rcu_key, rcu_unregister_reader);
+#ifdef __NR_membarrier
+		rcu_reader_fence = syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0)!=0;
+#endif
+	}
+} _rcu_init;
+
+rcu_reader* rcu_register_reader() {
+	pthread_mutex_lock(&rcu_readers_mut);
+	rcu_reader* r = rcu_readers;
+	while(r && r->bUsed) r = r->next;
+	if(!r) {
+		void* p = 0;
+		if(posix_memalign(&p, sizeof(rcu_reader), sizeof(rcu_reader))) abort();
+		r = (rcu_reader*)p;
+		r->ctr = 0;
+		r->next = rcu_readers;
+		__sync_synchronize();
+		rcu_readers = r;
+	}
+	r->bUsed = true;
+	pthread_mutex_unlock(&rcu_readers_mut);
+	pthread_setspecific(rcu_key, r);
+	rcu_self = r;
+	return r;
+}
+
+/** Readers that entered during the previous phase and are still in */
+static inline bool rcu_is_old(rcu_reader* r) {
+	unsigned long c = r->ctr;
+	return (c & RCU_NEST_MASK) && ((c ^ rcu_gp) & RCU_PHASE);
+}
+
+/**
+ * Two phase flips, as a reader may have read rcu_gp just before the first one and published it right after :
+ * after the second one, any reader still in the old phase entered before synchronize() started.
+ */
+void rcu_synchronize() {
+	pthread_mutex_lock(&rcu_gp_mut);
+	rcu_membarrier();
+	for(int phase=0; phase<2; phase++) {
+		rcu_gp ^= RCU_PHASE;
+		__sync_synchronize();
+		for(rcu_reader* r = rcu_readers; r; r = r->next) {
+			if(r==rcu_self) continue;
+			while(rcu_is_old(r)) sched_yield();
+		}
+	}
+	rcu_membarrier();
+	pthread_mutex_unlock(&rcu_gp_mut);
+}
@@ -0,0 +1,102 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#ifndef RCU_H_
+#define RCU_H_
+
+#include <sched.h>
+
+/**
+ * Minimal read-copy-update synchronization.
+ * Readers bracket their accesses with read_lock()/read_unlock(), which only write the calling thread's own slot
+ * (a cache line of its own) : readers never share a written cache line, whatever their number.
+ * Writers publish a new version, then synchronize() before freeing the old one :
+ * it returns once every reader that could have seen the old version has left.
+ * The reader side needs no memory fence : synchronize() forces one on all running threads (membarrier(2)),
+ * readers fall back to a fence of their own when the kernel can't.
+ * Grace periods are shared by all instances, and ignore the read section of the synchronizing thread itself.
+ */
+
+/** Reader slot of a thread : nesting depth in the low bits, grace period phase when it entered */
+struct rcu_reader {
+	volatile unsigned long ctr;
+	rcu_reader* volatile next;
+	volatile bool bUsed;
+} __attribute__((aligned(64)));
+
+#define RCU_NEST_MASK 0xffffUL
+#define RCU_PHASE (RCU_NEST_MASK+1)
+
+extern volatile unsigned long rcu_gp;
+extern bool rcu_reader_fence;
+extern __thread rcu_reader* rcu_self;
+
+rcu_reader* rcu_register_reader();
+void rcu_synchronize();
+
+class rcu {
+public:
+	inline int read_lock() {
+		rcu_reader* r = rcu_self;
+		if(!r) r = rcu_register_reader();
+		unsigned long c = r->ctr;
+		if(c & RCU_NEST_MASK) { r->ctr = c+1; return 0; }
+		r->ctr = rcu_gp;
+		if(rcu_reader_fence) __sync_synchronize();
+		else __asm__ __volatile__("" ::: "memory");
+		return 0;
+	}
+
+	inline void read_unlock(int) {
+		if(rcu_reader_fence) __sync_synchronize();
+		else __asm__ __volatile__("" ::: "memory");
+		rcu_self->ctr--;
+	}
+
+	inline void synchronize() { rcu_synchronize(); }
+};
+
+/** Read-side critical section for the enclosing scope */
+class rcu_read {
+	rcu& r;
+	int e;
+public:
+	rcu_read(rcu& r) : r(r) { e = r.read_lock(); }
+	~rcu_read() { r.read_unlock(e); }
+private:
+	rcu_read(const rcu_read&);
+	rcu_read& operator=(const rcu_read&);
+};
+
+
+#endif /* RCU_H_ */
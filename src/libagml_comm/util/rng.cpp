@@ -0,0 +1,52 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#include "rng.h"
+#include <pthread.h>
+
+static pthread_key_t _rng_key;
+static pthread_once_t _rng_key_once = PTHREAD_ONCE_INIT;
+static uint64_t _rng_nb_threads = 0;
+
+static void _rng_delete(void* p) { delete (Rng*)p; }
+static void _rng_create_key() { pthread_key_create(&_rng_key, _rng_delete); }
+
+Rng& rng_thread_local() {
+	pthread_once(&_rng_key_once, _rng_create_key);
+	Rng* rng = (Rng*) pthread_getspecific(_rng_key);
+	if(!rng) {
+		rng = new Rng(__sync_fetch_and_add(&_rng_nb_threads, 1));
+		pthread_setspecific(_rng_key, rng);
+	}
+	return *rng;
+}
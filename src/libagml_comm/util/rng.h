@@ -0,0 +1,116 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#ifndef AGML_RNG_H_
+#define AGML_RNG_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/**
+ * Small, lock-free pseudo random generator (xoshiro128**), meant to be owned by a single thread.
+ * Unlike rand(), it holds no global lock, so simulation threads don't serialize on it.
+ */
+class Rng {
+public:
+	uint32_t s[4];
+
+public:
+	Rng(uint64_t seed = 0) { this->seed(seed); }
+
+	/** Expand a 64 bits seed into the generator state (splitmix64) */
+	void seed(uint64_t seed) {
+		for(int i=0; i<4; i+=2) {
+			uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			z ^= z >> 31;
+			s[i] = (uint32_t)z; s[i+1] = (uint32_t)(z >> 32);
+		}
+	}
+
+	/** Seed from a number and a salt string, e.g. a node description */
+	void seed(uint64_t seed, const std::string& salt) {
+		uint64_t h = 14695981039346656037ULL; // FNV-1a
+		for(size_t i=0; i<salt.length(); i++) { h ^= (unsigned char)salt[i]; h *= 1099511628211ULL; }
+		this->seed(seed ^ h);
+	}
+
+	inline uint32_t next() {
+		uint32_t r = rotl(s[1]*5, 7)*9;
+		uint32_t t = s[1] << 9;
+		s[2] ^= s[0]; s[3] ^= s[1]; s[1] ^= s[2]; s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 11);
+		return r;
+	}
+
+	inline uint64_t next64() { uint64_t hi = next(); return (hi << 32) | next(); }
+
+	/** Uniform integer in [0,n[ */
+	inline uint32_t uniform(uint32_t n) { return (uint32_t)(((uint64_t)next() * n) >> 32); }
+
+	/** Uniform float in [0,1[ */
+	inline float randf() { return (next() >> 8) * (1.0f/16777216.0f); }
+	inline float randf(float min, float max) { return randf()*(max-min) + min; }
+
+	/**
+	 * Bulk generation of n uniform floats in [min,max[.
+	 * The generator steps are serial ; drawing them in batches first lets the conversions to floats vectorize.
+	 */
+	void fill(float* out, size_t n, float min = 0, float max = 1) {
+		uint32_t r[64];
+		float scale = (max-min) * (1.0f/16777216.0f);
+		for(size_t i=0; i<n; i+=64) {
+			size_t nb = n-i < 64 ? n-i : 64;
+			for(size_t j=0; j<nb; j++) r[j] = next();
+			for(size_t j=0; j<nb; j++) out[i+j] = (int)(r[j] >> 8) * scale + min;
+		}
+	}
+
+	/** Bulk generation of n uniform integers in [0,range[ */
+	void fill(uint32_t* out, size_t n, uint32_t range) {
+		for(size_t i=0; i<n; i++) out[i] = uniform(range);
+	}
+
+private:
+	static inline uint32_t rotl(uint32_t x, int k) { return (x << k) | (x >> (32-k)); }
+};
+
+
+/** Generator private to the calling thread, for code that has no Node or Thread at hand */
+Rng& rng_thread_local();
+
+
+#endif /* AGML_RNG_H_ */
@@ -0,0 +1,132 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#include "trace.h"
+#include "utils.h"
+#include "array.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+volatile bool trace_enabled = false;
+__thread TraceRing* trace_ring = 0;
+
+static array<TraceRing*> rings;
+static long ring_size = 65536;
+
+/** Clocks when tracing started : raw (see trace_clock()), monotonic in ns, and wall in µs so that hosts line up */
+static uint64_t start_clock = 0, start_ns = 0;
+static long start_us = 0;
+
+static uint64_t monotonic_ns() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec*1000000000ULL + t.tv_nsec;
+}
+
+TraceRing::TraceRing() {
+	tid = syscall(SYS_gettid);
+	events = 0;
+	mask = 0;
+	head = 0;
+}
+
+static TraceRing* trace_own_ring() {
+	if(!trace_ring) {
+		trace_ring = new TraceRing();
+		rings.add(trace_ring);
+	}
+	return trace_ring;
+}
+
+TraceRing* trace_new_ring() {
+	TraceRing* r = trace_own_ring();
+	if(!r->events) {
+		uint64_t n = 1;
+		while(n < (uint64_t)ring_size) n <<= 1;
+		r->mask = n-1;
+		__sync_synchronize();
+		r->events = new TraceEvent[n];
+	}
+	return r;
+}
+
+void trace_thread_name(const std::string& name) {
+	trace_own_ring()->name = name;
+}
+
+void trace_start(long size) {
+	ring_size = MAX(16, size);
+	start_clock = trace_clock();
+	start_ns = monotonic_ns();
+	start_us = get_time_us();
+	__sync_synchronize();
+	trace_enabled = true;
+}
+
+void trace_stop() {
+	trace_enabled = false;
+}
+
+long trace_write(const std::string& path, int pid, const std::string& process_name) {
+	FILE* f = fopen(path.c_str(), "w");
+	if(!f) return -1;
+
+	// Raw clock ticks to ns, as measured over the whole trace
+	uint64_t c = trace_clock(), ns = monotonic_ns();
+	double ns_per_tick = c>start_clock ? (double)(ns-start_ns)/(c-start_clock) : 1;
+
+	long nb = 0;
+	fprintf(f, "{\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"%s\"}}", pid, process_name.c_str());
+	array<TraceRing*>::snapshot s(rings);
+	for(size_t i=0; i<s.size(); i++) {
+		TraceRing* r = s[i];
+		if(!r->name.empty()) fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}", pid, r->tid, r->name.c_str());
+		if(!r->events) continue;
+		uint64_t head = r->head, size = r->mask+1;
+		for(uint64_t j = head>size ? head-size : 0; j<head; j++) {
+			const TraceEvent& e = r->events[j & r->mask];
+			if(e.t0 < start_clock || e.t1 < e.t0) continue;	// from an earlier trace
+			uint64_t t = (uint64_t)((e.t0-start_clock)*ns_per_tick);
+			uint64_t d = (uint64_t)((e.t1-e.t0)*ns_per_tick);
+			fprintf(f, ",\n{\"name\":\"%s%s%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,\"ts\":%ld.%03d,\"dur\":%ld.%03d}",
+					e.arg ? e.arg : "", e.arg ? "::" : "", e.name, pid, r->tid,
+					start_us + (long)(t/1000), (int)(t%1000), (long)(d/1000), (int)(d%1000));
+			nb++;
+		}
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	fclose(f);
+	return nb;
+}
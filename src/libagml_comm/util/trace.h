@@ -0,0 +1,118 @@
+/*
+Copyright © CNRS 2015. 
+Authors: Jerôme Fellus, David Picard and Philippe-Henri Gosselin
+Contact: jerome.fellus@ensea.fr, picard@ensea.fr, gosselin@ensea
+
+This software is governed by the CeCILL license under French law and
+abiding by the rules of distribution of free software.  You can  use, 
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info". 
+
+As a counterpart to the access to the source code and rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability. 
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or 
+data to be ensured and,  more generally, to use and operate it in the 
+same conditions as regards security. 
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL license and that you accept its terms.
+
+*/
+
+#ifndef AGML_TRACE_H_
+#define AGML_TRACE_H_
+
+#include <stdint.h>
+#include <string>
+#include <time.h>
+
+/**
+ * Span tracer : each thread records the spans it goes through in a ring of its own (the oldest ones are overwritten),
+ * dumped as Chrome/Perfetto trace events. When tracing is off, a span costs a test of trace_enabled.
+ */
+
+struct TraceEvent {
+	const char* name;
+	const char* arg;	// e.g. the Node class : the event is named "arg::name"
+	uint64_t t0, t1;
+};
+
+class TraceRing {
+public:
+	long tid;
+	std::string name;
+	TraceEvent* events;
+	uint64_t mask;
+	volatile uint64_t head;
+
+	TraceRing();
+};
+
+extern volatile bool trace_enabled;
+extern __thread TraceRing* trace_ring;
+
+/** Raw timestamp : the TSC where available (converted when written), else CLOCK_MONOTONIC ns */
+static inline uint64_t trace_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec*1000000000ULL + t.tv_nsec;
+#endif
+}
+
+/** Gives the calling thread its ring, or the events of a ring created by trace_thread_name() */
+TraceRing* trace_new_ring();
+
+static inline void trace_record(const char* name, const char* arg, uint64_t t0, uint64_t t1) {
+	TraceRing* r = trace_ring;
+	if(!r || !r->events) r = trace_new_ring();
+	TraceEvent& e = r->events[r->head & r->mask];
+	e.name = name; e.arg = arg; e.t0 = t0; e.t1 = t1;
+	r->head++;
+}
+
+/** Records the enclosing scope as a span named name (a string that must outlive the trace) */
+class TraceSpan {
+	const char* name;
+	const char* arg;
+	uint64_t t0;
+public:
+	inline TraceSpan(const char* name, const char* arg = 0) : name(trace_enabled ? name : 0), arg(arg) {
+		t0 = this->name ? trace_clock() : 0;
+	}
+	inline ~TraceSpan() { if(name) trace_record(name, arg, t0, trace_clock()); }
+};
+
+#define TRACE_SPAN(name) TraceSpan _trace_span(name)
+#define TRACE_SPAN_OF(name, arg) TraceSpan _trace_span(name, arg)
+
+
+/** Names the calling thread in traces */
+void trace_thread_name(const std::string& name);
+
+/** Starts recording, in rings of ring_size events per thread (rounded up to a power of two) */
+void trace_start(long ring_size);
+void trace_stop();
+
+/**
+ * Writes the spans recorded since the last trace_start() as Chrome trace events (JSON), under process id pid.
+ * @return the number of spans written, -1 if the file couldn't be created
+ */
+long trace_write(const std::string& path, int pid, const std::string& process_name);
+
+
+#endif /* AGML_TRACE_H_ */
@@ -34,6 +34,7 @@ knowledge of the CeCILL license and that you accept its terms.
 #include "utils.h"
 #include <execinfo.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <sys/stat.h>        /* For mode constants */
 #include <fcntl.h>
@@ -94,6 +95,38 @@ long get_time_ms() {
 	return (long)((t.tv_sec*1000.0) + (t.tv_usec/1000.0));
 }
 
+long get_time_us() {
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return t.tv_sec*1000000L + t.tv_usec;
+}
+
+long get_monotonic_us() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000000L + t.tv_nsec/1000L;
+}
+
+struct timespec get_deadline(long timeout_ms) {
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	struct timespec d;
+	long us = t.tv_usec + (timeout_ms%1000)*1000;
+	d.tv_sec = t.tv_sec + timeout_ms/1000 + us/1000000;
+	d.tv_nsec = (us%1000000)*1000;
+	return d;
+}
+
+long get_coarse_time_ms() {
+	struct timespec t;
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &t);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &t);
+#endif
+	return t.tv_sec*1000L + t.tv_nsec/1000000L;
+}
+
 std::string str_date() {
 	time_t _tm =time(NULL );
 	struct tm * curtime = localtime ( &_tm );
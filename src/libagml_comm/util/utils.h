@@ -148,6 +148,14 @@ void TAC();
 
 long get_time_seconds();
 long get_time_ms();
+/** Monotonic clock with a resolution of a few ms, much cheaper than get_time_ms() */
+long get_coarse_time_ms();
+/** Wall clock in µs, comparable across hosts as far as their clocks are synchronized */
+long get_time_us();
+/** Monotonic clock in µs, for durations measured on this host */
+long get_monotonic_us();
+/** Wall clock time timeout_ms from now, as the deadline of pthread_cond_timedwait() */
+struct timespec get_deadline(long timeout_ms);
 
 std::string str_date();
 